@@ -0,0 +1,32 @@
+#!/bin/sh
+# Profile-guided build: build instrumented, run each given VM headless through
+# pgo-train.txt to collect profiles, then rebuild with them.
+#
+#   ./pgo.sh <vm path> [<vm path> ...]
+#
+# The VMs should use "vid_renderer = null" and "enable_sync = 0" in [General],
+# and between them cover the interpreter and the dynarec and an SVGA card.
+# The profile directory (PGO_PROFILE_DIR, ./pgo by default) is kept, so ./pgo.sh
+# with no VM only does the PGO build.
+set -e
+
+EMU=${EMU:-./src/86Box4crt}
+TRAIN=${TRAIN:-./pgo-train.txt}
+PGO_PROFILE_DIR=${PGO_PROFILE_DIR:-$(pwd)/pgo}
+CMAKE_ARGS="-D CMAKE_TOOLCHAIN_FILE=./cmake/flags-gcc-x86_64.cmake -D QT=OFF -D WIN32=OFF --preset regular -D PGO_PROFILE_DIR=$PGO_PROFILE_DIR"
+
+if [ $# -gt 0 ]; then
+    [ -f build.ninja ] && ninja clean
+    rm -rf "$PGO_PROFILE_DIR"
+    cmake . $CMAKE_ARGS -D CMAKE_BUILD_TYPE=Instrument
+    ninja
+
+    for vm in "$@"; do
+        echo "Training with $vm"
+        "$EMU" --vmpath "$vm" --script "$TRAIN" --noconfirm
+    done
+fi
+
+[ -f build.ninja ] && ninja clean
+cmake . $CMAKE_ARGS -D CMAKE_BUILD_TYPE=PGO
+ninja
@@ -97,6 +97,10 @@
 #include <86box/version.h>
 #include <86box/gdbstub.h>
 #include <86box/machine_status.h>
+#include <86box/input_queue.h>
+#include <86box/harness.h>
+#include <86box/rom_index.h>
+#include <86box/log_queue.h>
 
 // Disable c99-designator to avoid the warnings about int ng
 #ifdef __clang__
@@ -161,6 +165,16 @@ int      video_filter_method              = 1;              /* (C) video */
 int      video_vsync                      = 0;              /* (C) video */
 int      video_b15kHz                     = 0;              /* (C) video psakhis switchres */
 int      video_framerate                  = -1;             /* (C) video */
+int      video_null_mode                  = 1;              /* (C) null renderer frame handling */
+int      video_frame_queue                = 0;              /* (C) frames queued for the renderer, 0 = none */
+int      video_frame_latest               = 0;              /* (C) drop the oldest queued frame when full */
+int      input_slice_ms                   = 1;              /* (C) input sub-slice length in ms */
+int      input_evdev                      = 0;              /* (C) read Linux evdev devices directly */
+int      speed_turbo                      = 0;              /* (C) run unthrottled, skipping frames */
+int      thread_cpu[PLAT_THREADS]         = { -1, -1, -1 }; /* (C) core to pin each thread to */
+int      thread_fifo_prio                 = 0;              /* (C) realtime thread priority */
+int      log_level                        = LOG_LEVEL_INFO; /* (C) most detailed level logged */
+int      log_timestamps                   = 0;              /* (C) prefix log lines with the time */
 char     video_shader[512]                = { '\0' };       /* (C) video */
 int      bugger_enabled                   = 0;              /* (C) enable ISAbugger */
 int      postcard_enabled                 = 0;              /* (C) enable POST card */
@@ -218,70 +232,50 @@ int hard_reset_pending = 0;
 
 static wchar_t mouse_msg[3][200];
 
-#ifndef RELEASE_BUILD
-static char buff[1024];
-static int  seen = 0;
-
-static int suppr_seen = 1;
-#endif
+static uint32_t startup_start; /* When pc_init() began, in us. */
+static uint32_t startup_last;  /* When the last startup stage ended. */
+static int      speed_slow;    /* pc_run() blocks in a row the host ran slower than real time. */
+static int64_t  speed_cycles;  /* Fraction of a cycle left over by the last block, in 1/1000. */
 
 /*
  * Log something to the logfile or stdout.
  *
- * To avoid excessively-large logfiles because some
- * module repeatedly logs, we keep track of what is
- * being logged, and catch repeating entries.
+ * The line is queued for the logger thread, see log_queue.c,
+ * which also catches repeating entries.
  */
 void
 pclog_ex(const char *fmt, va_list ap)
 {
 #ifndef RELEASE_BUILD
-    char temp[1024];
-
     if (strcmp(fmt, "") == 0)
         return;
 
-    if (stdlog == NULL) {
-        if (log_path[0] != '\0') {
-            stdlog = plat_fopen(log_path, "w");
-            if (stdlog == NULL)
-                stdlog = stdout;
-        } else
-            stdlog = stdout;
-    }
-
-    vsprintf(temp, fmt, ap);
-    if (suppr_seen && !strcmp(buff, temp))
-        seen++;
-    else {
-        if (suppr_seen && seen)
-            fprintf(stdlog, "*** %d repeats ***\n", seen);
-        seen = 0;
-        strcpy(buff, temp);
-        fprintf(stdlog, "%s", temp);
-    }
-
-    fflush(stdlog);
+    log_queue_add(LOG_LEVEL_INFO, fmt, ap);
 #endif
 }
 
+/* Log something. We only do this in non-release builds. */
 void
-pclog_toggle_suppr(void)
+pclog(const char *fmt, ...)
 {
 #ifndef RELEASE_BUILD
-    suppr_seen ^= 1;
+    va_list ap;
+
+    va_start(ap, fmt);
+    pclog_ex(fmt, ap);
+    va_end(ap);
 #endif
 }
 
-/* Log something. We only do this in non-release builds. */
+/* Log something at the given LOG_LEVEL_*, lines above log_level are left out. */
 void
-pclog(const char *fmt, ...)
+pclog_level(int level, const char *fmt, ...)
 {
 #ifndef RELEASE_BUILD
     va_list ap;
 
     va_start(ap, fmt);
-    pclog_ex(fmt, ap);
+    log_queue_add(level, fmt, ap);
     va_end(ap);
 #endif
 }
@@ -296,6 +290,9 @@ fatal(const char *fmt, ...)
 
     va_start(ap, fmt);
 
+    /* Everything logged before goes out first. */
+    log_queue_flush();
+
     if (stdlog == NULL) {
         if (log_path[0] != '\0') {
             stdlog = plat_fopen(log_path, "w");
@@ -313,6 +310,7 @@ fatal(const char *fmt, ...)
     nvr_save();
 
     config_save();
+    config_flush();
 
 #ifdef ENABLE_808X_LOG
     dumpregs(1);
@@ -339,6 +337,8 @@ fatal_ex(const char *fmt, va_list ap)
     char  temp[1024];
     char *sp;
 
+    log_queue_flush();
+
     if (stdlog == NULL) {
         if (log_path[0] != '\0') {
             stdlog = plat_fopen(log_path, "w");
@@ -355,6 +355,7 @@ fatal_ex(const char *fmt, va_list ap)
     nvr_save();
 
     config_save();
+    config_flush();
 
 #ifdef ENABLE_808X_LOG
     dumpregs(1);
@@ -391,6 +392,16 @@ pc_log(const char *fmt, ...)
 #    define pc_log(fmt, ...)
 #endif
 
+/* Log how long a startup stage took, and the total since pc_init() began. */
+void
+pc_startup_stage(const char *name)
+{
+    uint32_t now = plat_get_micro_ticks();
+
+    pclog("Startup: %s took %u ms (%u ms total)\n", name, (now - startup_last) / 1000, (now - startup_start) / 1000);
+    startup_last = now;
+}
+
 /*
  * Perform initial startup of the PC.
  *
@@ -403,6 +414,7 @@ pc_init(int argc, char *argv[])
 {
     char      *ppath = NULL, *rpath = NULL;
     char      *cfg = NULL, *p;
+    char      *hashrecord = NULL, *hashverify = NULL, *script = NULL;
     char       temp[2048], *fn[FDD_NUM] = { NULL };
     char       drive = 0, *temp2 = NULL;
     struct tm *info;
@@ -417,6 +429,8 @@ pc_init(int argc, char *argv[])
 #endif
     uint32_t lang_init = 0;
 
+    startup_start = startup_last = plat_get_micro_ticks();
+
     /* Grab the executable's full path. */
     plat_get_exe_name(exe_path, sizeof(exe_path) - 1);
     p  = path_get_filename(exe_path);
@@ -488,6 +502,10 @@ usage:
             printf("-R or --rompath path - set 'path' to be ROM path\n");
             printf("-S or --settings     - show only the settings dialog\n");
             printf("-V or --vmname name  - overrides the name of the running VM\n");
+            printf("--hashrecord path    - record a hash of every frame to 'path'\n");
+            printf("--hashverify path    - compare every frame with the hashes in 'path'\n");
+            printf("--script path        - run monitor commands from 'path' at emulated times\n");
+            printf("--seed n             - seed random numbers with 'n' in harness runs\n");
             printf("-Z or --lastvmpath   - the last parameter is VM path rather than config\n");
             printf("\nA config file can be specified. If none is, the default file will be used.\n");
             return (0);
@@ -553,6 +571,26 @@ usage:
                 goto usage;
 
             strcpy(vm_name, argv[++c]);
+        } else if (!strcasecmp(argv[c], "--hashrecord")) {
+            if ((c + 1) == argc)
+                goto usage;
+
+            hashrecord = argv[++c];
+        } else if (!strcasecmp(argv[c], "--hashverify")) {
+            if ((c + 1) == argc)
+                goto usage;
+
+            hashverify = argv[++c];
+        } else if (!strcasecmp(argv[c], "--script")) {
+            if ((c + 1) == argc)
+                goto usage;
+
+            script = argv[++c];
+        } else if (!strcasecmp(argv[c], "--seed")) {
+            if ((c + 1) == argc)
+                goto usage;
+
+            harness_seed = strtoul(argv[++c], NULL, 0);
         } else if (!strcasecmp(argv[c], "--settings") || !strcasecmp(argv[c], "-S")) {
             settings_only = 1;
         } else if (!strcasecmp(argv[c], "--noconfirm") || !strcasecmp(argv[c], "-N")) {
@@ -782,6 +820,9 @@ usage:
 
     gdbstub_init();
 
+    if (!harness_init(hashrecord, hashverify, script))
+        return (0);
+
     /* All good! */
     return (1);
 }
@@ -809,7 +850,10 @@ pc_full_speed(void)
 int
 pc_init_modules(void)
 {
-    int     c, m;
+    int     c;
+#ifdef PRINT_MISSING_MACHINES_AND_VIDEO_CARDS
+    int     m;
+#endif
     wchar_t temp[512];
     char    tempc[512];
 
@@ -833,7 +877,6 @@ pc_init_modules(void)
             pclog("Missing video card: %s\n", tempc);
         c++;
     }
-#endif
 
     pc_log("Scanning for ROM images:\n");
     c = m = 0;
@@ -841,45 +884,47 @@ pc_init_modules(void)
         c += machine_available(m);
         m++;
     }
-    if (c == 0) {
-        /* No usable ROMs found, aborting. */
-        return (0);
-    }
     pc_log("A total of %d ROM sets have been loaded.\n", c);
+#endif
+
+    pc_startup_stage("configuration");
+
+    /* Availability comes from the ROM index, only devices it does not know yet are probed. */
+    rom_index_init();
 
     /* Load the ROMs for the selected machine. */
-    if (!machine_available(machine)) {
+    if (!rom_index_machine_available(machine)) {
         swprintf(temp, sizeof(temp), plat_get_string(IDS_2063), machine_getname());
         c       = 0;
         machine = -1;
         while (machine_get_internal_name_ex(c) != NULL) {
-            if (machine_available(c)) {
+            if (rom_index_machine_available(c)) {
                 ui_msgbox_header(MBX_INFO, (wchar_t *) IDS_2129, temp);
                 machine = c;
-                config_save();
+                config_save_sections(CONFIG_SECTION_MACHINE);
                 break;
             }
             c++;
         }
         if (machine == -1) {
-            fatal("No available machines\n");
-            exit(-1);
+            /* No usable ROMs found, aborting. */
+            rom_index_save();
             return (0);
         }
     }
 
     /* Make sure we have a usable video card. */
-    if (!video_card_available(gfxcard)) {
+    if (!rom_index_video_card_available(gfxcard)) {
         memset(tempc, 0, sizeof(tempc));
         device_get_name(video_card_getdevice(gfxcard), 0, tempc);
         swprintf(temp, sizeof(temp), plat_get_string(IDS_2064), tempc);
         c = 0;
         while (video_get_internal_name(c) != NULL) {
             gfxcard = -1;
-            if (video_card_available(c)) {
+            if (rom_index_video_card_available(c)) {
                 ui_msgbox_header(MBX_INFO, (wchar_t *) IDS_2129, temp);
                 gfxcard = c;
-                config_save();
+                config_save_sections(CONFIG_SECTION_VIDEO);
                 break;
             }
             c++;
@@ -891,7 +936,7 @@ pc_init_modules(void)
         }
     }
 
-    if (!video_card_available(gfxcard_2)) {
+    if (!rom_index_video_card_available(gfxcard_2)) {
         char tempc[512] = { 0 };
         device_get_name(video_card_getdevice(gfxcard_2), 0, tempc);
         swprintf(temp, sizeof(temp), (wchar_t *) "Video card #2 \"%hs\" is not available due to missing ROMs in the roms/video directory. Disabling the second video card.", tempc);
@@ -899,11 +944,18 @@ pc_init_modules(void)
         gfxcard_2 = 0;
     }
 
+    rom_index_save();
+    pc_startup_stage("ROM check");
+
     atfullspeed = 0;
 
     random_init();
+    /* Whatever uses the C library's random numbers repeats in harness runs. */
+    if (harness_active)
+        srand(harness_seed);
 
     mem_init();
+    pc_startup_stage("memory");
 
 #ifdef USE_DYNAREC
 #    if defined(__APPLE__) && defined(__aarch64__)
@@ -913,14 +965,19 @@ pc_init_modules(void)
 #    if defined(__APPLE__) && defined(__aarch64__)
     pthread_jit_write_protect_np(1);
 #    endif
+    pc_startup_stage("recompiler");
 #endif
 
     keyboard_init();
     joystick_init();
+    pc_startup_stage("input");
 
     video_init();
+    pc_startup_stage("video");
 
+    /* Opens and reads the configured floppy images. */
     fdd_init();
+    pc_startup_stage("floppy");
 
     sound_init();
 
@@ -929,6 +986,7 @@ pc_init_modules(void)
     video_reset_close();
 
     machine_status_init();
+    pc_startup_stage("devices");
 
     return (1);
 }
@@ -1012,6 +1070,9 @@ pc_reset_hard_close(void)
 void
 pc_reset_hard_init(void)
 {
+    /* A fresh machine starts on a whole cycle. */
+    speed_cycles = 0;
+
     /*
      * First, we reset the modules that are not part of
      * the actual machine, but which support some of the
@@ -1183,6 +1244,7 @@ pc_close(thread_t *ptr)
     nvr_save();
 
     config_save();
+    config_flush();
 
     plat_mouse_capture(0);
 
@@ -1225,6 +1287,12 @@ pc_close(thread_t *ptr)
     scsi_disk_close();
 
     gdbstub_close();
+
+    harness_close();
+
+    rom_index_close();
+
+    log_queue_close();
 }
 
 #ifdef __APPLE__
@@ -1236,11 +1304,49 @@ _ui_window_title(void *s)
 }
 #endif
 
+/*
+ * Speed governor, called by the platform main thread with the emulated
+ * time that is due in ms. Returns the length of the next pc_run() block
+ * and takes it off the backlog. When behind, the block grows up to
+ * SPEED_SLICE_MAX ms so the per-block overhead is paid less often. A
+ * backlog the host cannot work off, because the last SPEED_SLOW_BLOCKS
+ * blocks all took longer to run than they emulated, is dropped rather
+ * than chased; a single slow block is caught up on. In turbo mode a block
+ * is always due and nothing is ever owed. Under the test harness blocks
+ * are always SPEED_SLICE_MIN ms, so where cycles and input land does not
+ * depend on how fast the host is.
+ */
+int
+pc_speed_slice(int *due)
+{
+    int ms;
+
+    if (speed_turbo) {
+        *due = 0;
+        return SPEED_SLICE_MIN;
+    }
+
+    if (harness_active)
+        ms = SPEED_SLICE_MIN;
+    else
+        ms = MIN(MAX(*due - (*due % SPEED_SLICE_MIN), SPEED_SLICE_MIN), SPEED_SLICE_MAX);
+    *due -= ms;
+
+    if ((*due > SPEED_SLICE_MAX) || ((*due > 0) && (speed_slow >= SPEED_SLOW_BLOCKS)))
+        *due = 0;
+
+    return ms;
+}
+
 void
-pc_run(void)
+pc_run(int ms)
 {
-    int     mouse_msg_idx;
-    wchar_t temp[200];
+    int      mouse_msg_idx;
+    int      slices;
+    int      cycles;
+    uint32_t start;
+    uint32_t window;
+    wchar_t  temp[200];
 
     /* Trigger a hard reset if one is pending. */
     if (hard_reset_pending) {
@@ -1249,18 +1355,46 @@ pc_run(void)
         pc_reset_hard_init();
     }
 
-    /* Run a block of code. */
+    /* Run a block of code, in sub-slices of input_slice_ms. The block stands
+       for the last ms of host time, most of which the main loop spent waiting;
+       each host input event goes to the sub-slice at the same offset into the
+       block as its arrival into that host time. Events arriving while the block
+       runs stay queued for the next one. */
+    slices = MAX(ms / input_slice_ms, 1);
+    start  = plat_get_micro_ticks();
+    window = start - (uint32_t) (ms * 1000);
+
+    /* Carry the remainder, so the cycles run do not depend on how the time
+       was cut into blocks. */
+    speed_cycles += (int64_t) cpu_s->rspeed * ms;
+    cycles = speed_cycles / 1000;
+    speed_cycles %= 1000;
+
     startblit();
-    cpu_exec(cpu_s->rspeed / 100);
+    for (int i = 0; i < slices; i++) {
+        /* Scripted commands take effect at their emulated time, their keys with them. */
+        if (harness_active && harness_script_run(harness_time() + ((i * ms) / slices)))
+            input_queue_drain(plat_get_micro_ticks());
+        else
+            input_queue_drain(window + (uint32_t) (((i + 1) * ms * 1000) / slices));
+        cpu_exec((cycles * (i + 1)) / slices - (cycles * i) / slices);
 #ifdef USE_GDBSTUB /* avoid a KBC FIFO overflow when CPU emulation is stalled */
-    if (gdbstub_step == GDBSTUB_EXEC)
+        if (gdbstub_step == GDBSTUB_EXEC)
 #endif
-        mouse_process();
-    joystick_process();
+            mouse_process();
+        joystick_process();
+    }
     endblit();
+    if ((plat_get_micro_ticks() - start) > (uint32_t) (ms * 1000))
+        speed_slow++;
+    else
+        speed_slow = 0;
+
+    if (harness_active)
+        harness_tick(ms);
 
     /* Done with this frame, update statistics. */
-    framecount++;
+    framecount += ms;
     if (++framecountx >= 100) {
         framecountx = 0;
         frames      = 0;
@@ -1283,7 +1417,7 @@ pc_run(void)
 void
 pc_onesec(void)
 {
-    fps        = framecount;
+    fps        = framecount / 10;
     framecount = 0;
 
     title_update = 1;
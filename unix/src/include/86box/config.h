@@ -135,8 +135,28 @@ typedef struct {
 } config_t;
 #endif
 
+/* Sections for config_save_sections(). */
+#define CONFIG_SECTION_GENERAL      0x0001
+#define CONFIG_SECTION_MONITORS     0x0002
+#define CONFIG_SECTION_MACHINE      0x0004
+#define CONFIG_SECTION_VIDEO        0x0008
+#define CONFIG_SECTION_INPUT        0x0010
+#define CONFIG_SECTION_SOUND        0x0020
+#define CONFIG_SECTION_NETWORK      0x0040
+#define CONFIG_SECTION_PORTS        0x0080
+#define CONFIG_SECTION_STORAGE      0x0100 /* Storage controllers, cassette and cartridges */
+#define CONFIG_SECTION_HARD_DISKS   0x0200
+#define CONFIG_SECTION_FLOPPY_CDROM 0x0400
+#define CONFIG_SECTION_REMOVABLE    0x0800 /* ZIP and MO drives */
+#define CONFIG_SECTION_PERIPHERALS  0x1000
+#define CONFIG_SECTION_ALL          0x1fff
+
+#define CONFIG_SAVE_DELAY 500 /* ms a save waits for others to be written with it */
+
 extern void config_load(void);
 extern void config_save(void);
+extern void config_save_sections(int sections);
+extern void config_flush(void);
 
 #ifdef EMU_INI_H
 extern ini_t config_get_ini(void);
@@ -0,0 +1,40 @@
+/*
+ * 86Box    A hypervisor and IBM PC system emulator that specializes in
+ *          running old operating systems and software designed for IBM
+ *          PC systems and compatibles from 1981 through fairly recent
+ *          system designs based on the PCI bus.
+ *
+ *          This file is part of the 86Box distribution.
+ *
+ *          Definitions for the log queues.
+ *
+ *          Every thread that logs formats its lines into its own
+ *          single-producer/single-consumer ring, a logger thread drains
+ *          all rings and writes them out in batches.
+ */
+#ifndef EMU_LOG_QUEUE_H
+#define EMU_LOG_QUEUE_H
+
+#define LOG_LEVEL_ERROR 0
+#define LOG_LEVEL_WARN  1
+#define LOG_LEVEL_INFO  2 /* pclog() */
+#define LOG_LEVEL_DEBUG 3
+
+#define LOG_QUEUE_LINE  1024 /* Longest line kept, longer ones are cut. */
+#define LOG_QUEUE_SIZE  256  /* Lines per ring, must be a power of 2. */
+#define LOG_QUEUE_MAX   32   /* Threads that can get a ring, others write directly. */
+#define LOG_QUEUE_FLUSH 50   /* ms between two writes of the logger thread. */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+extern void log_queue_add(int level, const char *fmt, va_list ap);
+extern void log_queue_flush(void);
+extern void log_queue_close(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /*EMU_LOG_QUEUE_H*/
@@ -0,0 +1,33 @@
+/*
+ * 86Box    A hypervisor and IBM PC system emulator that specializes in
+ *          running old operating systems and software designed for IBM
+ *          PC systems and compatibles from 1981 through fairly recent
+ *          system designs based on the PCI bus.
+ *
+ *          This file is part of the 86Box distribution.
+ *
+ *          Definitions for the ROM availability index.
+ */
+#ifndef EMU_ROM_INDEX_H
+#define EMU_ROM_INDEX_H
+
+#define ROM_INDEX_FILE    "roms.idx"
+#define ROM_INDEX_VERSION 3
+#define ROM_INDEX_DEPTH   8  /* Directory levels below a ROM path that are tracked. */
+#define ROM_INDEX_MISSING -1 /* Time and size recorded for a ROM path that does not exist. */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+extern void rom_index_init(void);
+extern void rom_index_save(void);
+extern void rom_index_close(void);
+extern int  rom_index_machine_available(int m);
+extern int  rom_index_video_card_available(int card);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /*EMU_ROM_INDEX_H*/
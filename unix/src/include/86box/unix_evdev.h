@@ -0,0 +1,18 @@
+/*
+ * 86Box    A hypervisor and IBM PC system emulator that specializes in
+ *          running old operating systems and software designed for IBM
+ *          PC systems and compatibles from 1981 through fairly recent
+ *          system designs based on the PCI bus.
+ *
+ *          This file is part of the 86Box distribution.
+ *
+ *          Header file for the Linux evdev input reader.
+ */
+
+#ifndef UNIX_EVDEV_H
+#define UNIX_EVDEV_H
+
+extern int  evdev_init(void);
+extern void evdev_close(void);
+
+#endif /*!UNIX_EVDEV_H*/
@@ -63,6 +63,8 @@ enum {
 #define VIDEO_FLAG_TYPE_NONE    3
 #define VIDEO_FLAG_TYPE_MASK    3
 
+#define VIDEO_FRAME_QUEUE_MAX 8 /* Deepest frame queue between the emulation and blit threads. */
+
 typedef struct {
     int type;
     int write_b, write_w, write_l;
@@ -117,6 +119,9 @@ typedef struct monitor_t {
     const video_timings_t   *mon_vid_timings;
     int                      mon_vid_type;
     struct blit_data_struct *mon_blit_data_ptr;
+    int                      mon_trim_rows; /* Target buffer rows that may be resident. */
+    uint32_t                 mon_trim_time; /* When fewer rows became enough, 0 if not. */
+    bitmap_t                *mon_blit_buffer; /* What the renderer reads, the target buffer or a frame queue slot. */
 } monitor_t;
 
 typedef struct monitor_settings_t {
@@ -144,6 +149,9 @@ extern unsigned char      switchres_interlace;
 extern int                switchres_switch;
 //end psakhis
 
+extern void switchres_stats_begin(void);
+extern void switchres_stats_end(void);
+
 typedef rgb_t PALETTE[256];
 
 // extern int	changeframecount;
@@ -151,6 +159,7 @@ typedef rgb_t PALETTE[256];
 extern volatile int screenshots;
 // extern bitmap_t	*buffer32;
 #define buffer32             (monitors[monitor_index_global].target_buffer)
+#define blit_buffer32        (monitors[monitor_index_global].mon_blit_buffer)
 #define pal_lookup           (monitors[monitor_index_global].mon_pal_lookup)
 #define overscan_x           (monitors[monitor_index_global].mon_overscan_x)
 #define overscan_y           (monitors[monitor_index_global].mon_overscan_y)
@@ -185,11 +194,11 @@ extern uint8_t      fontdat8x12[256][16];
 extern uint8_t      fontdat12x18[256][36];
 extern dbcs_font_t *fontdatksc5601;
 extern dbcs_font_t *fontdatksc5601_user;
-extern uint32_t    *video_6to8,
-    *video_8togs,
-    *video_8to32,
-    *video_15to32,
-    *video_16to32;
+extern const uint32_t video_6to8[256],
+    video_8togs[256],
+    video_8to32[256],
+    video_15to32[65536],
+    video_16to32[65536];
 extern int enable_overscan;
 extern int force_43;
 extern int vid_resize;
@@ -215,6 +224,7 @@ extern void *__cdecl video_transform_copy(void *_Dst, const void *_Src, size_t _
 extern void *(*video_copy)(void *__restrict _Dst, const void *__restrict _Src, size_t _Size);
 extern void *video_transform_copy(void *__restrict _Dst, const void *__restrict _Src, size_t _Size);
 #endif
+extern void (*video_fill)(uint32_t *p, uint32_t col, int n);
 
 /* Table functions. */
 extern int video_card_available(int card);
@@ -237,12 +247,15 @@ extern void video_blit_memtoscreen_8(int x, int y, int w, int h);
 extern void video_blend_monitor(int x, int y, int monitor_index);
 extern void video_process_8_monitor(int x, int y, int monitor_index);
 extern void video_blit_memtoscreen_monitor(int x, int y, int w, int h, int monitor_index);
+extern void video_setblitdrop(int (*drop)(int monitor_index));
+extern int  video_frame_skip(int monitor_index);
 extern void video_blit_complete_monitor(int monitor_index);
 extern void video_wait_for_blit_monitor(int monitor_index);
 extern void video_wait_for_buffer_monitor(int monitor_index);
 
 extern bitmap_t *create_bitmap(int w, int h);
 extern void      destroy_bitmap(bitmap_t *b);
+extern void      plat_mem_discard(void *ptr, size_t size); /* Platform, drop pages keeping the range mapped. */
 extern void      cgapal_rebuild_monitor(int monitor_index);
 extern void      hline(bitmap_t *b, int x1, int y, int x2, uint32_t col);
 extern void      updatewindowsize(int x, int y);
@@ -0,0 +1,401 @@
+/*
+ * 86Box    A hypervisor and IBM PC system emulator that specializes in
+ *          running old operating systems and software designed for IBM
+ *          PC systems and compatibles from 1981 through fairly recent
+ *          system designs based on the PCI bus.
+ *
+ *          This file is part of the 86Box distribution.
+ *
+ *          Log queues.
+ *
+ *          pclog() used to format, compare against the previous line and
+ *          write and flush the log file on the thread that logged, which
+ *          on the blit and emulation threads changed the very timing that
+ *          was being looked at. Now each thread only formats its line
+ *          into its own ring, without taking any lock. A logger thread
+ *          wakes every LOG_QUEUE_FLUSH ms, merges the rings by the time
+ *          the lines were logged and writes them with a single flush.
+ *          Repeated lines are folded on the logger thread as before.
+ *          The ring of a thread that exits is handed to the next thread
+ *          that logs, once the logger has written out what was left in it.
+ */
+#ifdef _WIN32
+#    define BITMAP WINDOWS_BITMAP
+#    include <windows.h>
+#    undef BITMAP
+#else
+#    include <pthread.h>
+#endif
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wchar.h>
+#include <86box/86box.h>
+#include <86box/plat.h>
+#include <86box/thread.h>
+#include <86box/log_queue.h>
+
+#ifdef USE_NEW_DYNAREC
+extern FILE *stdlog;
+#endif
+
+/* States of the queue as a whole. */
+#define LOG_QUEUE_IDLE     0
+#define LOG_QUEUE_STARTING 1
+#define LOG_QUEUE_RUNNING  2
+#define LOG_QUEUE_CLOSED   3
+
+/* States of a ring. */
+#define RING_USED   0 /* Its thread is alive. */
+#define RING_EXITED 1 /* Its thread is gone, lines may be left. */
+#define RING_FREE   2 /* Written out, the next new thread can take it. */
+
+typedef struct log_line_t {
+    uint32_t time; /* Host time, plat_get_micro_ticks() */
+    char     text[LOG_QUEUE_LINE];
+} log_line_t;
+
+typedef struct log_ring_t {
+    log_line_t   line[LOG_QUEUE_SIZE];
+    atomic_uint  head;    /* Next slot to write, owning thread. */
+    atomic_uint  tail;    /* Next slot to read, logger side. */
+    atomic_uint  dropped; /* Lines lost to a full ring. */
+    atomic_int   owner;   /* RING_USED, RING_EXITED or RING_FREE. */
+    unsigned int drain;   /* Logger side, end of the lines being written. */
+} log_ring_t;
+
+typedef struct log_batch_t {
+    const log_line_t *line;
+    int               order; /* Keeps the lines of one thread in order at equal times. */
+} log_batch_t;
+
+static _Atomic(log_ring_t *) rings[LOG_QUEUE_MAX];
+static atomic_int            ring_count = 0;
+static __thread log_ring_t  *ring;
+static __thread int          ring_failed;
+
+static atomic_int  started = LOG_QUEUE_IDLE;
+static mutex_t    *write_mutex;
+static thread_t   *logger;
+static log_batch_t batch[LOG_QUEUE_MAX * LOG_QUEUE_SIZE];
+
+/* Gives each ring back when its thread exits. */
+#ifdef _WIN32
+static DWORD ring_key = FLS_OUT_OF_INDEXES;
+#else
+static pthread_key_t ring_key;
+static int           ring_key_ok = 0;
+#endif
+
+/* Writer state, only used with write_mutex held. */
+static char     last[LOG_QUEUE_LINE];
+static int      seen       = 0;
+static int      suppr_seen = 1;
+static int      line_start = 1;
+static uint32_t first_time;
+
+static void
+log_queue_open(void)
+{
+    if (stdlog != NULL)
+        return;
+
+    if (log_path[0] != '\0') {
+        stdlog = plat_fopen(log_path, "w");
+        if (stdlog == NULL)
+            stdlog = stdout;
+    } else
+        stdlog = stdout;
+}
+
+/* To avoid excessively-large logfiles because some module repeatedly logs, repeating lines are counted instead. */
+static void
+log_queue_out(uint32_t time, const char *text)
+{
+    size_t   len = strlen(text);
+    uint32_t us;
+
+    if (suppr_seen && !strcmp(last, text)) {
+        seen++;
+        return;
+    }
+
+    if (suppr_seen && seen)
+        fprintf(stdlog, "*** %d repeats ***\n", seen);
+    seen = 0;
+    strcpy(last, text);
+
+    if (log_timestamps && line_start) {
+        us = time - first_time;
+        fprintf(stdlog, "[%5u.%06u] ", us / 1000000, us % 1000000);
+    }
+
+    fputs(text, stdlog);
+
+    /* Lines can be built from several calls, only the first part gets a time. */
+    if (len)
+        line_start = (text[len - 1] == '\n');
+}
+
+static int
+log_queue_compare(const void *a, const void *b)
+{
+    const log_batch_t *x = (const log_batch_t *) a;
+    const log_batch_t *y = (const log_batch_t *) b;
+    int32_t            d = (int32_t) (x->line->time - y->line->time);
+
+    if (d)
+        return (d > 0) - (d < 0);
+
+    return x->order - y->order;
+}
+
+/* Write out everything queued so far, with write_mutex held. */
+static void
+log_queue_drain(void)
+{
+    log_ring_t  *r;
+    unsigned int tail, head;
+    unsigned int dropped = 0;
+    int          count   = 0;
+
+    for (int i = 0; i < LOG_QUEUE_MAX; i++) {
+        if ((r = atomic_load(&rings[i])) == NULL)
+            continue;
+
+        tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+        head = atomic_load_explicit(&r->head, memory_order_acquire);
+
+        for (; tail != head; tail++) {
+            batch[count].line  = &r->line[tail & (LOG_QUEUE_SIZE - 1)];
+            batch[count].order = count;
+            count++;
+        }
+
+        r->drain = head;
+        dropped += atomic_exchange_explicit(&r->dropped, 0, memory_order_relaxed);
+    }
+
+    if (count || dropped) {
+        log_queue_open();
+
+        qsort(batch, count, sizeof(log_batch_t), log_queue_compare);
+        for (int i = 0; i < count; i++)
+            log_queue_out(batch[i].line->time, batch[i].line->text);
+
+        if (dropped)
+            fprintf(stdlog, "*** %u lines lost to full log queues ***\n", dropped);
+
+        fflush(stdlog);
+    }
+
+    /* Only now hand the slots back to their threads. */
+    for (int i = 0; i < LOG_QUEUE_MAX; i++) {
+        if ((r = atomic_load(&rings[i])) == NULL)
+            continue;
+
+        atomic_store_explicit(&r->tail, r->drain, memory_order_release);
+
+        /* The head of an exited thread no longer moves, so once all of it
+           is written the ring can go to another thread. */
+        if ((atomic_load(&r->owner) == RING_EXITED) && (r->drain == atomic_load(&r->head)))
+            atomic_store(&r->owner, RING_FREE);
+    }
+}
+
+static void
+log_queue_thread(void *priv)
+{
+    while (atomic_load(&started) == LOG_QUEUE_RUNNING) {
+        plat_delay_ms(LOG_QUEUE_FLUSH);
+        log_queue_flush();
+    }
+}
+
+/* Called by the system when a thread that has a ring exits. */
+#ifdef _WIN32
+static void WINAPI
+#else
+static void
+#endif
+log_queue_exit(void *priv)
+{
+    log_ring_t *r = (log_ring_t *) priv;
+
+    if (r != NULL)
+        atomic_store(&r->owner, RING_EXITED);
+}
+
+/* Set up the queue once, returns its state when done. */
+static int
+log_queue_start(void)
+{
+    int state = LOG_QUEUE_IDLE;
+
+    if (atomic_compare_exchange_strong(&started, &state, LOG_QUEUE_STARTING)) {
+        write_mutex = thread_create_mutex();
+        first_time  = plat_get_micro_ticks();
+
+#ifdef _WIN32
+        ring_key = FlsAlloc(log_queue_exit);
+#else
+        ring_key_ok = !pthread_key_create(&ring_key, log_queue_exit);
+#endif
+
+        /* Whatever is still queued when the emulator exits goes out too. */
+        atexit(log_queue_flush);
+
+        /* Running must be set for the logger thread to loop. */
+        atomic_store(&started, LOG_QUEUE_RUNNING);
+        logger = thread_create(log_queue_thread, NULL);
+
+        return LOG_QUEUE_RUNNING;
+    }
+
+    /* Another thread is setting up, nothing can be used before it is done. */
+    while (state == LOG_QUEUE_STARTING) {
+        plat_delay_ms(1);
+        state = atomic_load(&started);
+    }
+
+    return state;
+}
+
+static log_ring_t *
+log_queue_register(void)
+{
+    log_ring_t *r;
+    int         owner;
+    int         n;
+
+    /* Take over the ring of a thread that has exited, if there is one. */
+    for (n = 0; n < LOG_QUEUE_MAX; n++) {
+        owner = RING_FREE;
+        if (((r = atomic_load(&rings[n])) != NULL) && atomic_compare_exchange_strong(&r->owner, &owner, RING_USED)) {
+            ring = r;
+            break;
+        }
+    }
+
+    if (ring == NULL) {
+        n = atomic_fetch_add(&ring_count, 1);
+        if (n >= LOG_QUEUE_MAX) {
+            ring_failed = 1;
+            return NULL;
+        }
+
+        ring = (log_ring_t *) calloc(1, sizeof(log_ring_t));
+        if (ring == NULL) {
+            ring_failed = 1;
+            return NULL;
+        }
+
+        atomic_store(&rings[n], ring);
+    }
+
+#ifdef _WIN32
+    if (ring_key != FLS_OUT_OF_INDEXES)
+        FlsSetValue(ring_key, ring);
+#else
+    if (ring_key_ok)
+        pthread_setspecific(ring_key, ring);
+#endif
+
+    return ring;
+}
+
+void
+log_queue_add(int level, const char *fmt, va_list ap)
+{
+    log_ring_t  *r = ring;
+    log_line_t  *line;
+    char         temp[LOG_QUEUE_LINE];
+    unsigned int head, tail;
+    int          state;
+
+    if (level > log_level)
+        return;
+
+    state = atomic_load(&started);
+    if ((state == LOG_QUEUE_IDLE) || (state == LOG_QUEUE_STARTING))
+        state = log_queue_start();
+
+    if ((r == NULL) && !ring_failed && (state == LOG_QUEUE_RUNNING))
+        r = log_queue_register();
+
+    if ((r == NULL) || (state == LOG_QUEUE_CLOSED)) {
+        /* No ring left for this thread or no logger thread anymore,
+           write it out the old way. */
+        vsnprintf(temp, sizeof(temp), fmt, ap);
+
+        thread_wait_mutex(write_mutex);
+        log_queue_drain();
+        log_queue_open();
+        log_queue_out(plat_get_micro_ticks(), temp);
+        fflush(stdlog);
+        thread_release_mutex(write_mutex);
+        return;
+    }
+
+    head = atomic_load_explicit(&r->head, memory_order_relaxed);
+    tail = atomic_load_explicit(&r->tail, memory_order_acquire);
+
+    if ((head - tail) >= LOG_QUEUE_SIZE) {
+        atomic_fetch_add_explicit(&r->dropped, 1, memory_order_relaxed);
+        return;
+    }
+
+    line       = &r->line[head & (LOG_QUEUE_SIZE - 1)];
+    line->time = plat_get_micro_ticks();
+    vsnprintf(line->text, sizeof(line->text), fmt, ap);
+
+    /* Publish the slot only once it is fully written. */
+    atomic_store_explicit(&r->head, head + 1, memory_order_release);
+}
+
+/* Write out all queued lines now, from any thread. */
+void
+log_queue_flush(void)
+{
+    if (write_mutex == NULL)
+        return;
+
+    thread_wait_mutex(write_mutex);
+    log_queue_drain();
+    thread_release_mutex(write_mutex);
+}
+
+/* Stop the logger thread, the lines logged from now on are written directly. */
+void
+log_queue_close(void)
+{
+    int state = LOG_QUEUE_RUNNING;
+
+    if (log_queue_start() != LOG_QUEUE_RUNNING)
+        return;
+
+    if (!atomic_compare_exchange_strong(&started, &state, LOG_QUEUE_CLOSED))
+        return;
+
+    thread_wait(logger);
+    logger = NULL;
+
+    log_queue_flush();
+}
+
+void
+pclog_toggle_suppr(void)
+{
+#ifndef RELEASE_BUILD
+    if (write_mutex != NULL)
+        thread_wait_mutex(write_mutex);
+
+    suppr_seen ^= 1;
+
+    if (write_mutex != NULL)
+        thread_release_mutex(write_mutex);
+#endif
+}
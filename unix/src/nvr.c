@@ -0,0 +1,492 @@
+/*
+ * 86Box    A hypervisor and IBM PC system emulator that specializes in
+ *          running old operating systems and software designed for IBM
+ *          PC systems and compatibles from 1981 through fairly recent
+ *          system designs based on the PCI bus.
+ *
+ *          This file is part of the 86Box distribution.
+ *
+ *          Implement a generic NVRAM/CMOS/RTC device.
+ *
+ *          nvr_save() used to write the file on the emulation thread,
+ *          which on slow storage showed up as a hitch in the frame
+ *          cadence. It now only copies the NVR bytes; a background
+ *          writer puts them on disk through a temporary file, so a
+ *          power cut never leaves half of one. A save is skipped when
+ *          the bytes hash the same as the ones last loaded or written.
+ *
+ *
+ *
+ * Authors: Fred N. van Kempen, <decwiz@yahoo.com>,
+ *          David Hrdlička, <hrdlickadavid@outlook.com>
+ *
+ *          Copyright 2017-2020 Fred N. van Kempen.
+ *          Copyright 2018-2020 David Hrdlička.
+ */
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <wchar.h>
+#define HAVE_STDARG_H
+#include <86box/86box.h>
+#include "cpu.h"
+#include <86box/device.h>
+#include <86box/machine.h>
+#include <86box/timer.h>
+#include <86box/path.h>
+#include <86box/plat.h>
+#include <86box/thread.h>
+#include <86box/nvr.h>
+
+int nvr_dosave; /* NVR is dirty, needs saved */
+
+static int8_t    days_in_month[12] = { 31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31 };
+static struct tm intclk;
+static nvr_t    *saved_nvr = NULL;
+static char      saved_path[1024]; /* File of saved_nvr, resolved when it is loaded. */
+static uint64_t  saved_hash;       /* Of the bytes last loaded from or handed for that file. */
+static int       saved_hash_valid;
+
+/* Background writer, see nvr_save(). */
+static mutex_t  *nvr_mutex;
+static event_t  *nvr_wake;
+static thread_t *nvr_writer;
+static int       nvr_writer_run;
+static int       nvr_pending;
+static uint8_t   nvr_snap[NVR_MAXSIZE];
+static int       nvr_snap_size;
+static char      nvr_snap_path[1024];
+
+#ifdef ENABLE_NVR_LOG
+int nvr_do_log = ENABLE_NVR_LOG;
+
+static void
+nvr_log(const char *fmt, ...)
+{
+    va_list ap;
+
+    if (nvr_do_log) {
+        va_start(ap, fmt);
+        pclog_ex(fmt, ap);
+        va_end(ap);
+    }
+}
+#else
+#    define nvr_log(fmt, ...)
+#endif
+
+/* Determine whether or not the year is leap. */
+int
+nvr_is_leap(int year)
+{
+    if (year % 400 == 0)
+        return 1;
+    if (year % 100 == 0)
+        return 0;
+    if (year % 4 == 0)
+        return 1;
+
+    return 0;
+}
+
+/* Determine the days in the current month. */
+int
+nvr_get_days(int month, int year)
+{
+    if (month != 2)
+        return (days_in_month[month - 1]);
+
+    return (nvr_is_leap(year) ? 29 : 28);
+}
+
+/* One more second has passed, update the internal clock. */
+void
+rtc_tick(void)
+{
+    /* Ping the internal clock. */
+    if (++intclk.tm_sec == 60) {
+        intclk.tm_sec = 0;
+        if (++intclk.tm_min == 60) {
+            intclk.tm_min = 0;
+            if (++intclk.tm_hour == 24) {
+                intclk.tm_hour = 0;
+                if (++intclk.tm_mday == (nvr_get_days(intclk.tm_mon, intclk.tm_year) + 1)) {
+                    intclk.tm_mday = 1;
+                    if (++intclk.tm_mon == 13) {
+                        intclk.tm_mon = 1;
+                        intclk.tm_year++;
+                    }
+                }
+            }
+        }
+    }
+}
+
+/* This is the RTC one-second timer. */
+static void
+onesec_timer(void *priv)
+{
+    nvr_t *nvr = (nvr_t *) priv;
+    int    is_at;
+
+    if (++nvr->onesec_cnt >= 100) {
+        /* Update the internal clock. */
+        is_at = IS_AT(machine);
+        if (!is_at)
+            rtc_tick();
+
+        /* Update the RTC device if needed. */
+        if (nvr->tick != NULL)
+            (*nvr->tick)(nvr);
+
+        nvr->onesec_cnt = 0;
+    }
+
+    timer_advance_u64(&nvr->onesec_time, (uint64_t) (10000ULL * TIMER_USEC));
+}
+
+/* FNV-1a, only to notice that the NVR did not change since it was last written. */
+static uint64_t
+nvr_hash(const uint8_t *data, int size)
+{
+    uint64_t hash = 0xcbf29ce484222325ULL;
+
+    for (int i = 0; i < size; i++)
+        hash = (hash ^ data[i]) * 0x100000001b3ULL;
+
+    return hash;
+}
+
+/*
+ * Write the last snapshot if there is one, through a temporary file. Only
+ * taking the snapshot needs nvr_mutex, so a save coming in meanwhile does
+ * not wait for the disk. There is only ever one writer, the background
+ * thread or nvr_flush() once it has stopped it.
+ */
+static void
+nvr_write_pending(void)
+{
+    uint8_t data[NVR_MAXSIZE];
+    char    path[1024], temp[1024 + 8];
+    int     size = 0;
+    int     pending;
+    int     ok;
+    FILE   *fp;
+
+    thread_wait_mutex(nvr_mutex);
+    pending = nvr_pending;
+    if (pending) {
+        size = nvr_snap_size;
+        memcpy(data, nvr_snap, size);
+        strcpy(path, nvr_snap_path);
+        nvr_pending = 0;
+    }
+    thread_release_mutex(nvr_mutex);
+
+    if (!pending)
+        return;
+
+    nvr_log("NVR: saving to '%s'\n", path);
+    snprintf(temp, sizeof(temp), "%s.tmp", path);
+    if ((fp = plat_fopen(temp, "wb")) == NULL) {
+        pclog("NVR: unable to write %s\n", path);
+        return;
+    }
+
+    ok = (fwrite(data, 1, size, fp) == (size_t) size);
+    if (fclose(fp) || !ok || plat_file_replace(path, temp)) {
+        pclog("NVR: unable to write %s\n", path);
+        plat_remove(temp);
+    }
+}
+
+static void
+nvr_writer_thread(void *priv)
+{
+    while (1) {
+        thread_wait_event(nvr_wake, -1);
+        thread_reset_event(nvr_wake);
+
+        if (!nvr_writer_run)
+            break;
+
+        nvr_write_pending();
+    }
+}
+
+/* Write a pending save right away and stop the background writer. */
+static void
+nvr_flush(void)
+{
+    thread_t *writer;
+
+    if (nvr_mutex == NULL)
+        return;
+
+    thread_wait_mutex(nvr_mutex);
+    writer         = nvr_writer;
+    nvr_writer     = NULL;
+    nvr_writer_run = 0;
+    thread_release_mutex(nvr_mutex);
+
+    if (writer != NULL) {
+        thread_set_event(nvr_wake);
+        thread_wait(writer);
+    }
+
+    nvr_write_pending();
+}
+
+/* Initialize the generic NVRAM/RTC device. */
+void
+nvr_init(nvr_t *nvr)
+{
+    int c;
+
+    /* Set up the filename if needed. */
+    if (nvr->fn == NULL) {
+        c       = strlen(machine_get_internal_name()) + 5;
+        nvr->fn = (char *) malloc(c + 1);
+        sprintf(nvr->fn, "%s.nvr", machine_get_internal_name());
+    }
+
+    /* Initialize the internal clock as needed. */
+    memset(&intclk, 0x00, sizeof(intclk));
+    if (time_sync & TIME_SYNC_ENABLED) {
+        nvr_time_sync();
+    } else {
+        /* Reset the internal clock to 1980/01/01 00:00. */
+        intclk.tm_mon  = 1;
+        intclk.tm_year = 1980;
+    }
+
+    /* Set up our timer. */
+    timer_add(&nvr->onesec_time, onesec_timer, nvr, 1);
+
+    /* It does not need saving yet. */
+    nvr_dosave = 0;
+
+    /* The writer outlives machines, anything still queued goes out at exit. */
+    if (nvr_mutex == NULL) {
+        nvr_mutex = thread_create_mutex();
+        nvr_wake  = thread_create_event();
+        atexit(nvr_flush);
+    }
+
+    /* Save the NVR data pointer. */
+    saved_nvr = nvr;
+
+    /* Try to load the saved data. */
+    (void) nvr_load();
+}
+
+/* Get path to the NVR folder. */
+char *
+nvr_path(char *str)
+{
+    static char temp[1024];
+
+    /* Get the full prefix in place. */
+    memset(temp, 0x00, sizeof(temp));
+    path_append_filename(temp, usr_path, NVR_PATH);
+
+    /* Create the directory if needed. */
+    if (!plat_dir_check(temp))
+        plat_dir_create(temp);
+
+    /* Now append the actual filename. */
+    path_slash(temp);
+    strcat(temp, str);
+
+    return (temp);
+}
+
+/*
+ * Load an NVR from file.
+ *
+ * This function does two things, really. It clears and initializes
+ * the RTC and NVRAM areas, sets up defaults for the RTC part, and
+ * then attempts to load data from a saved file.
+ *
+ * Either way, after loading, it will continue to initialize the
+ * RTC by setting its time and date.
+ */
+int
+nvr_load(void)
+{
+    char   *path;
+    FILE   *fp;
+    uint8_t regs[NVR_MAXSIZE] = { 0 };
+
+    /* Make sure we have been initialized. */
+    if (saved_nvr == NULL)
+        return (0);
+
+    /* Clear out any old data. */
+    memset(saved_nvr->regs, 0x00, sizeof(saved_nvr->regs));
+
+    /* Set the defaults. */
+    if (saved_nvr->reset != NULL)
+        saved_nvr->reset(saved_nvr);
+
+    /* A save still queued for this file must land before it is read. */
+    nvr_flush();
+    saved_hash_valid = 0;
+
+    /* Load the (relevant) part of the NVR contents. */
+    if (saved_nvr->size != 0) {
+        path = nvr_path(saved_nvr->fn);
+        strncpy(saved_path, path, sizeof(saved_path) - 1);
+        nvr_log("NVR: loading from '%s'\n", path);
+        fp                = plat_fopen(path, "rb");
+        saved_nvr->is_new = (fp == NULL);
+        if (fp != NULL) {
+            memcpy(regs, saved_nvr->regs, sizeof(regs));
+            /* Read NVR contents from file. */
+            if (fread(saved_nvr->regs, 1, saved_nvr->size, fp) != saved_nvr->size) {
+                memcpy(saved_nvr->regs, regs, sizeof(regs));
+                saved_nvr->is_new = 1;
+            } else {
+                saved_hash       = nvr_hash(saved_nvr->regs, saved_nvr->size);
+                saved_hash_valid = 1;
+            }
+            (void) fclose(fp);
+        }
+    } else
+        saved_nvr->is_new = 1;
+
+    /* Get the local RTC running! */
+    if (saved_nvr->start != NULL)
+        saved_nvr->start(saved_nvr);
+
+    return (1);
+}
+
+void
+nvr_set_ven_save(void (*ven_save)(void))
+{
+    saved_nvr->ven_save = ven_save;
+}
+
+/*
+ * Save the current NVR to a file. Only a snapshot is taken here, the
+ * background writer does the file I/O.
+ */
+int
+nvr_save(void)
+{
+    uint64_t hash;
+
+    /* Make sure we have been initialized. */
+    if (saved_nvr == NULL)
+        return (0);
+
+    if (saved_nvr->size != 0) {
+        hash = nvr_hash(saved_nvr->regs, saved_nvr->size);
+
+        if (saved_hash_valid && (hash == saved_hash)) {
+            nvr_log("NVR: '%s' unchanged, not saved\n", saved_path);
+        } else {
+            thread_wait_mutex(nvr_mutex);
+            memcpy(nvr_snap, saved_nvr->regs, saved_nvr->size);
+            nvr_snap_size = saved_nvr->size;
+            strcpy(nvr_snap_path, saved_path);
+            nvr_pending = 1;
+
+            if (nvr_writer == NULL) {
+                nvr_writer_run = 1;
+                nvr_writer     = thread_create(nvr_writer_thread, NULL);
+            }
+            thread_release_mutex(nvr_mutex);
+
+            thread_set_event(nvr_wake);
+
+            saved_hash       = hash;
+            saved_hash_valid = 1;
+        }
+    }
+
+    if (saved_nvr->ven_save)
+        saved_nvr->ven_save();
+
+    /* Device is clean again. */
+    nvr_dosave = 0;
+
+    return (1);
+}
+
+/* The machine is going away, its last save must be on disk before the next one loads. */
+void
+nvr_close(void)
+{
+    nvr_flush();
+
+    saved_nvr        = NULL;
+    saved_hash_valid = 0;
+}
+
+void
+nvr_time_sync(void)
+{
+    struct tm *tm;
+    time_t     now;
+
+    /* Get the current time of day, and convert to local time. */
+    (void) time(&now);
+    if (time_sync & TIME_SYNC_UTC)
+        tm = gmtime(&now);
+    else
+        tm = localtime(&now);
+
+    /* Set the internal clock. */
+    nvr_time_set(tm);
+}
+
+/* Get current time from internal clock. */
+void
+nvr_time_get(struct tm *tm)
+{
+    uint8_t  dom;
+    uint8_t  mon;
+    uint8_t  sum;
+    uint8_t  wd;
+    uint16_t cent;
+    uint16_t yr;
+
+    tm->tm_sec  = intclk.tm_sec;
+    tm->tm_min  = intclk.tm_min;
+    tm->tm_hour = intclk.tm_hour;
+    dom         = intclk.tm_mday;
+    mon         = intclk.tm_mon;
+    yr          = (intclk.tm_year % 100);
+    cent        = ((intclk.tm_year - yr) / 100) % 4;
+    sum         = dom + mon + yr + cent;
+    wd          = ((sum + 6) % 7);
+    tm->tm_wday = wd;
+    tm->tm_mday = intclk.tm_mday;
+    tm->tm_mon  = (intclk.tm_mon - 1);
+    tm->tm_year = (intclk.tm_year - 1900);
+}
+
+/* Set internal clock time. */
+void
+nvr_time_set(struct tm *tm)
+{
+    intclk.tm_sec  = tm->tm_sec;
+    intclk.tm_min  = tm->tm_min;
+    intclk.tm_hour = tm->tm_hour;
+    intclk.tm_wday = tm->tm_wday;
+    intclk.tm_mday = tm->tm_mday;
+    intclk.tm_mon  = (tm->tm_mon + 1);
+    intclk.tm_year = (tm->tm_year + 1900);
+}
+
+/* Open or create a file in the NVR area. */
+FILE *
+nvr_fopen(char *str, char *mode)
+{
+    return (plat_fopen(nvr_path(str), mode));
+}
@@ -0,0 +1,366 @@
+/*
+ * 86Box    A hypervisor and IBM PC system emulator that specializes in
+ *          running old operating systems and software designed for IBM
+ *          PC systems and compatibles from 1981 through fairly recent
+ *          system designs based on the PCI bus.
+ *
+ *          This file is part of the 86Box distribution.
+ *
+ *          ROM availability index.
+ *
+ *          machine_available() and video_card_available() look for the
+ *          ROM files of a device in every ROM path, which on slow storage
+ *          adds up to a large part of the startup time. Their answers are
+ *          kept in roms.idx in the user directory, together with the size
+ *          and modification time of every directory below the ROM paths.
+ *          Adding, removing or renaming a ROM changes the time of the
+ *          directory holding it, so while all directories still match,
+ *          the index answers without touching any ROM file. Otherwise it
+ *          is thrown away and filled again as devices are probed. A ROM
+ *          path that does not exist yet is recorded as missing, so that
+ *          creating it later counts as a change too.
+ */
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wchar.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#define HAVE_STDARG_H
+#include <86box/86box.h>
+#include <86box/device.h>
+#include <86box/machine.h>
+#include <86box/rom.h>
+#include <86box/video.h>
+#include <86box/path.h>
+#include <86box/plat.h>
+#include <86box/plat_dir.h>
+#include <86box/rom_index.h>
+#include <86box/version.h>
+
+typedef struct {
+    char    path[1024];
+    int64_t mtime;
+    int64_t size;
+} rom_index_dir_t;
+
+typedef struct {
+    char type; /* 'm' for a machine, 'v' for a video card */
+    char name[128];
+    int  avail;
+} rom_index_entry_t;
+
+static rom_index_dir_t   *dirs;
+static int                dirs_num, dirs_max;
+static rom_index_entry_t *entries;
+static int                entries_num, entries_max;
+static int                dirty;
+
+#ifdef ENABLE_ROM_INDEX_LOG
+int rom_index_do_log = ENABLE_ROM_INDEX_LOG;
+
+static void
+rom_index_log(const char *fmt, ...)
+{
+    va_list ap;
+
+    if (rom_index_do_log) {
+        va_start(ap, fmt);
+        pclog_ex(fmt, ap);
+        va_end(ap);
+    }
+}
+#else
+#    define rom_index_log(fmt, ...)
+#endif
+
+/* ROM paths end in a separator, which stat() does not accept on every host. */
+static void
+rom_index_trim(char *dest, const char *path)
+{
+    size_t len;
+
+    strncpy(dest, path, 1023);
+    dest[1023] = '\0';
+
+    len = strlen(dest);
+    while ((len > 1) && ((dest[len - 1] == '/') || (dest[len - 1] == '\\')))
+        dest[--len] = '\0';
+}
+
+/* Modification times are kept in ns, with whole seconds a ROM copied in
+   during the second the index was written would go unnoticed. */
+static int
+rom_index_stat(const char *path, int64_t *mtime, int64_t *size)
+{
+    struct stat st;
+
+    if (stat(path, &st) || !S_ISDIR(st.st_mode)) {
+        *mtime = *size = ROM_INDEX_MISSING;
+        return 0;
+    }
+
+#if defined(__APPLE__)
+    *mtime = ((int64_t) st.st_mtimespec.tv_sec * 1000000000) + st.st_mtimespec.tv_nsec;
+#elif defined(_WIN32)
+    *mtime = (int64_t) st.st_mtime * 1000000000;
+#else
+    *mtime = ((int64_t) st.st_mtim.tv_sec * 1000000000) + st.st_mtim.tv_nsec;
+#endif
+    *size = (int64_t) st.st_size;
+    return 1;
+}
+
+static void
+rom_index_add_dir(const char *path, int64_t mtime, int64_t size)
+{
+    if (dirs_num == dirs_max) {
+        dirs_max = dirs_max ? (dirs_max * 2) : 64;
+        dirs     = realloc(dirs, dirs_max * sizeof(rom_index_dir_t));
+    }
+
+    strncpy(dirs[dirs_num].path, path, sizeof(dirs[dirs_num].path) - 1);
+    dirs[dirs_num].path[sizeof(dirs[dirs_num].path) - 1] = '\0';
+    dirs[dirs_num].mtime                                 = mtime;
+    dirs[dirs_num].size                                  = size;
+    dirs_num++;
+}
+
+/* Record a directory and every directory below it. */
+static void
+rom_index_walk(const char *path, int depth)
+{
+    struct dirent *entry;
+    DIR           *dirp;
+    char           child[1024];
+    int64_t        mtime, size;
+
+    if (!rom_index_stat(path, &mtime, &size)) {
+        /* A ROM path that is not there (yet), only noted so its creation is seen. */
+        if (depth == 0)
+            rom_index_add_dir(path, mtime, size);
+        return;
+    }
+
+    rom_index_add_dir(path, mtime, size);
+
+    if ((depth >= ROM_INDEX_DEPTH) || !(dirp = opendir(path)))
+        return;
+
+    while ((entry = readdir(dirp))) {
+        if (!strcmp(entry->d_name, ".") || !strcmp(entry->d_name, ".."))
+            continue;
+
+        path_append_filename(child, path, entry->d_name);
+        rom_index_walk(child, depth + 1);
+    }
+
+    closedir(dirp);
+}
+
+static void
+rom_index_reset(void)
+{
+    char root[1024];
+
+    dirs_num    = 0;
+    entries_num = 0;
+
+    for (rom_path_t *rom_path = &rom_paths; rom_path != NULL; rom_path = rom_path->next) {
+        if (rom_path->path[0] == '\0')
+            continue;
+
+        rom_index_trim(root, rom_path->path);
+        rom_index_walk(root, 0);
+    }
+
+    dirty = 1;
+}
+
+static void
+rom_index_add_entry(char type, const char *name, int avail)
+{
+    if (entries_num == entries_max) {
+        entries_max = entries_max ? (entries_max * 2) : 128;
+        entries     = realloc(entries, entries_max * sizeof(rom_index_entry_t));
+    }
+
+    entries[entries_num].type = type;
+    strncpy(entries[entries_num].name, name, sizeof(entries[entries_num].name) - 1);
+    entries[entries_num].name[sizeof(entries[entries_num].name) - 1] = '\0';
+    entries[entries_num].avail                                       = avail;
+    entries_num++;
+}
+
+/* The build that wrote the index, another one may have different ROM lists. */
+static const char *
+rom_index_build(void)
+{
+    static char build[128];
+
+#ifdef EMU_GIT_HASH
+    snprintf(build, sizeof(build), "%s %i %s", EMU_VERSION_FULL, EMU_BUILD_NUM, EMU_GIT_HASH);
+#else
+    snprintf(build, sizeof(build), "%s %i", EMU_VERSION_FULL, EMU_BUILD_NUM);
+#endif
+
+    return build;
+}
+
+/* Load the index, and keep it only if it was written by this build and the ROM
+   directories did not change since. */
+void
+rom_index_init(void)
+{
+    char        fn[1024], line[1280], name[128];
+    FILE       *fp;
+    rom_path_t *rom_path = &rom_paths;
+    int         version  = 0;
+    int         valid    = 1;
+    int         built    = 0;
+    int         pos, avail, checked = 0;
+    long long   mtime, size;
+    int64_t     cur_mtime, cur_size;
+    uint32_t    start = plat_get_ticks();
+
+    path_append_filename(fn, usr_path, ROM_INDEX_FILE);
+    if ((fp = plat_fopen(fn, "r")) == NULL) {
+        rom_index_reset();
+        return;
+    }
+
+    while (valid && fgets(line, sizeof(line), fp)) {
+        line[strcspn(line, "\r\n")] = '\0';
+
+        if ((line[0] == '#') || (line[0] == '\0'))
+            continue;
+
+        if (sscanf(line, "version %i", &version) == 1) {
+            valid = (version == ROM_INDEX_VERSION);
+        } else if (!strncmp(line, "build ", 6)) {
+            valid = built = !strcmp(line + 6, rom_index_build());
+        } else if (!strncmp(line, "root ", 5)) {
+            /* The ROM paths must be the same ones, in the same order. */
+            while ((rom_path != NULL) && (rom_path->path[0] == '\0'))
+                rom_path = rom_path->next;
+            valid = (rom_path != NULL) && !strcmp(line + 5, rom_path->path);
+            if (valid)
+                rom_path = rom_path->next;
+        } else if (sscanf(line, "dir %lld %lld %n", &mtime, &size, &pos) == 2) {
+            rom_index_stat(line + pos, &cur_mtime, &cur_size);
+            valid = (cur_mtime == mtime) && (cur_size == size);
+            if (valid)
+                rom_index_add_dir(line + pos, mtime, size);
+            checked++;
+        } else if (sscanf(line, "machine %i %127s", &avail, name) == 2) {
+            rom_index_add_entry('m', name, avail);
+        } else if (sscanf(line, "video %i %127s", &avail, name) == 2) {
+            rom_index_add_entry('v', name, avail);
+        } else
+            valid = 0;
+    }
+
+    fclose(fp);
+
+    while ((rom_path != NULL) && (rom_path->path[0] == '\0'))
+        rom_path = rom_path->next;
+
+    if (!valid || (version != ROM_INDEX_VERSION) || !built || (rom_path != NULL)) {
+        pclog("ROM index: ROMs or emulator changed, rebuilding\n");
+        rom_index_reset();
+        return;
+    }
+
+    dirty = 0;
+    pclog("ROM index: %i devices, %i directories checked in %u ms\n", entries_num, checked, plat_get_ticks() - start);
+}
+
+static int
+rom_index_lookup(char type, const char *name, int (*probe)(int), int id)
+{
+    int avail;
+
+    if (name == NULL)
+        return 0;
+
+    for (int i = 0; i < entries_num; i++) {
+        if ((entries[i].type == type) && !strcmp(entries[i].name, name))
+            return entries[i].avail;
+    }
+
+    avail = probe(id);
+    rom_index_log("ROM index: probed %c %s = %i\n", type, name, avail);
+
+    rom_index_add_entry(type, name, avail);
+    dirty = 1;
+
+    return avail;
+}
+
+int
+rom_index_machine_available(int m)
+{
+    return rom_index_lookup('m', machine_get_internal_name_ex(m), machine_available, m);
+}
+
+int
+rom_index_video_card_available(int card)
+{
+    return rom_index_lookup('v', video_get_internal_name(card), video_card_available, card);
+}
+
+/* Write the index back if anything had to be probed, through a temporary
+   file so a power cut never leaves half of it. */
+void
+rom_index_save(void)
+{
+    char  fn[1024], temp[1024 + 8];
+    FILE *fp;
+
+    if (!dirty)
+        return;
+
+    path_append_filename(fn, usr_path, ROM_INDEX_FILE);
+    snprintf(temp, sizeof(temp), "%s.tmp", fn);
+    if ((fp = plat_fopen(temp, "w")) == NULL) {
+        pclog("ROM index: unable to write %s\n", temp);
+        return;
+    }
+
+    fprintf(fp, "# 86Box ROM availability index, safe to delete\n");
+    fprintf(fp, "version %i\n", ROM_INDEX_VERSION);
+    fprintf(fp, "build %s\n", rom_index_build());
+
+    for (rom_path_t *rom_path = &rom_paths; rom_path != NULL; rom_path = rom_path->next) {
+        if (rom_path->path[0] != '\0')
+            fprintf(fp, "root %s\n", rom_path->path);
+    }
+
+    for (int i = 0; i < dirs_num; i++)
+        fprintf(fp, "dir %lld %lld %s\n", (long long) dirs[i].mtime, (long long) dirs[i].size, dirs[i].path);
+
+    for (int i = 0; i < entries_num; i++)
+        fprintf(fp, "%s %i %s\n", (entries[i].type == 'm') ? "machine" : "video", entries[i].avail, entries[i].name);
+
+    if (fclose(fp) || plat_file_replace(fn, temp)) {
+        pclog("ROM index: unable to write %s\n", fn);
+        plat_remove(temp);
+        return;
+    }
+
+    dirty = 0;
+}
+
+void
+rom_index_close(void)
+{
+    free(dirs);
+    free(entries);
+
+    dirs        = NULL;
+    entries     = NULL;
+    dirs_num    = dirs_max = 0;
+    entries_num = entries_max = 0;
+}
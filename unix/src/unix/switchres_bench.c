@@ -0,0 +1,148 @@
+/*
+ * 86Box    A hypervisor and IBM PC system emulator that specializes in
+ *          running old operating systems and software designed for IBM
+ *          PC systems and compatibles from 1981 through fairly recent
+ *          system designs based on the PCI bus.
+ *
+ *          This file is part of the 86Box distribution.
+ *
+ *          Mode switch benchmark.
+ *
+ *          Walks the modes a PC commonly goes through (text 720x400,
+ *          320x200, 640x350 and 640x480, each progressive and interlaced)
+ *          through libswitchres, asking for the same line counts as the
+ *          renderers do. After each switch, a frame buffer of the new size
+ *          is rebuilt and filled, like a renderer's texture. Prints p50,
+ *          p99 and max of the whole switch per mode.
+ *
+ *          Built with -D SWITCHRES_STUB=ON against the stub libswitchres,
+ *          so it runs headless; SR_STUB_DELAY_US sets the modeled driver
+ *          time. Usage:
+ *
+ *              switchres_bench [switches per mode] [p99 limit in us]
+ *
+ *          Exits with 1 if a switch fails or a mode's p99 is over the limit.
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <86box/switchres_wrapper.h>
+
+#define BENCH_SWITCHES 100
+
+typedef struct bench_mode_t {
+    int    width;
+    int    height;
+    double refresh;
+} bench_mode_t;
+
+static const bench_mode_t bench_modes[] = {
+    { 720, 400, 70.086 },
+    { 320, 200, 70.086 },
+    { 640, 350, 70.086 },
+    { 640, 480, 59.940 }
+};
+
+#define BENCH_MODES (sizeof(bench_modes) / sizeof(bench_modes[0]))
+
+static uint32_t
+bench_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint32_t) ((ts.tv_sec * 1000000ULL) + (ts.tv_nsec / 1000));
+}
+
+static int
+bench_compare(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *) a;
+    uint32_t y = *(const uint32_t *) b;
+
+    return (x > y) - (x < y);
+}
+
+/* Like a renderer, drop the old texture and build one for the new mode. */
+static uint32_t *
+bench_rebuild(uint32_t *pixels, int width, int height)
+{
+    free(pixels);
+
+    pixels = malloc((size_t) width * height * sizeof(uint32_t));
+    if (pixels != NULL)
+        memset(pixels, 0, (size_t) width * height * sizeof(uint32_t));
+
+    return pixels;
+}
+
+int
+main(int argc, char **argv)
+{
+    int       switches = (argc > 1) ? atoi(argv[1]) : BENCH_SWITCHES;
+    uint32_t  limit    = (argc > 2) ? (uint32_t) strtoul(argv[2], NULL, 10) : 0;
+    uint32_t *us[BENCH_MODES * 2];
+    uint32_t *pixels = NULL;
+    uint32_t  start;
+    sr_mode   mode;
+    int       ret = 0;
+
+    if (switches <= 0)
+        switches = BENCH_SWITCHES;
+
+    sr_init();
+    if (!sr_init_disp("auto", NULL)) {
+        fprintf(stderr, "switchres_bench: no display\n");
+        return 1;
+    }
+
+    for (size_t m = 0; m < BENCH_MODES * 2; m++) {
+        us[m] = calloc(switches, sizeof(uint32_t));
+        if (us[m] == NULL) {
+            fprintf(stderr, "switchres_bench: out of memory\n");
+            return 1;
+        }
+    }
+
+    /* Go round all modes, so every switch really changes the mode. */
+    for (int i = 0; i < switches; i++) {
+        for (size_t m = 0; m < BENCH_MODES * 2; m++) {
+            const bench_mode_t *b         = &bench_modes[m / 2];
+            unsigned char       interlace = m & 1;
+
+            start = bench_us();
+            if (!sr_switch_to_mode(b->width, interlace ? 480 : 240, b->refresh, interlace, &mode)) {
+                fprintf(stderr, "switchres_bench: switch to %dx%d%s failed\n", b->width, b->height, interlace ? "i" : "p");
+                ret = 1;
+            }
+            pixels   = bench_rebuild(pixels, b->width, b->height);
+            us[m][i] = bench_us() - start;
+        }
+    }
+
+    for (size_t m = 0; m < BENCH_MODES * 2; m++) {
+        const bench_mode_t *b = &bench_modes[m / 2];
+        uint32_t            p99;
+
+        qsort(us[m], switches, sizeof(uint32_t), bench_compare);
+        p99 = us[m][(switches * 99) / 100];
+
+        printf("%dx%d%s: %d switches, p50 %u us, p99 %u us, max %u us\n",
+               b->width, b->height, (m & 1) ? "i" : "p", switches, us[m][switches / 2], p99, us[m][switches - 1]);
+
+        if (limit && (p99 > limit)) {
+            printf("%dx%d%s: p99 over the %u us limit\n", b->width, b->height, (m & 1) ? "i" : "p", limit);
+            ret = 1;
+        }
+
+        free(us[m]);
+    }
+
+    free(pixels);
+    sr_deinit();
+
+    return ret;
+}
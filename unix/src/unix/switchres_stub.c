@@ -0,0 +1,158 @@
+/*
+ * 86Box    A hypervisor and IBM PC system emulator that specializes in
+ *          running old operating systems and software designed for IBM
+ *          PC systems and compatibles from 1981 through fairly recent
+ *          system designs based on the PCI bus.
+ *
+ *          This file is part of the 86Box distribution.
+ *
+ *          Stand-in for libswitchres.
+ *
+ *          Implements the switchres C wrapper API without touching any
+ *          display, so mode switch latency can be measured without a
+ *          CRT attached. Each mode switch sleeps for SR_STUB_DELAY_US
+ *          microseconds (default 0) to model the driver, and returns the
+ *          requested mode unchanged.
+ *
+ *          Build with -D SWITCHRES_STUB=ON and put the resulting
+ *          libswitchres.so first in LD_LIBRARY_PATH. The switch times
+ *          are reported per mode when the emulator exits. The same
+ *          build makes switchres_bench, which walks the common modes
+ *          through this library without the emulator.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <86box/switchres_wrapper.h>
+
+static long stub_delay_us = -1;
+
+static void
+stub_delay(void)
+{
+    struct timespec ts;
+
+    if (stub_delay_us < 0) {
+        const char *env = getenv("SR_STUB_DELAY_US");
+
+        stub_delay_us = env ? strtol(env, NULL, 10) : 0;
+        if (stub_delay_us < 0)
+            stub_delay_us = 0;
+    }
+
+    if (!stub_delay_us)
+        return;
+
+    ts.tv_sec  = stub_delay_us / 1000000;
+    ts.tv_nsec = (stub_delay_us % 1000000) * 1000;
+    while (nanosleep(&ts, &ts))
+        ;
+}
+
+static unsigned char
+stub_mode(int width, int height, double refresh, unsigned char interlace, sr_mode *mode)
+{
+    stub_delay();
+
+    if (mode) {
+        memset(mode, 0, sizeof(sr_mode));
+        mode->width     = width;
+        mode->height    = height;
+        mode->refresh   = refresh;
+        mode->interlace = interlace;
+        mode->x_scale   = 1;
+        mode->y_scale   = 1;
+    }
+
+    return 1;
+}
+
+MODULE_API void
+sr_init(void)
+{
+}
+
+MODULE_API void
+sr_load_ini(char *config)
+{
+}
+
+MODULE_API void
+sr_deinit(void)
+{
+}
+
+MODULE_API unsigned char
+sr_init_disp(const char *screen, void *window)
+{
+    return 1;
+}
+
+MODULE_API unsigned char
+sr_add_mode(int width, int height, double refresh, unsigned char interlace, sr_mode *mode)
+{
+    return stub_mode(width, height, refresh, interlace, mode);
+}
+
+MODULE_API unsigned char
+sr_switch_to_mode(int width, int height, double refresh, unsigned char interlace, sr_mode *mode)
+{
+    return stub_mode(width, height, refresh, interlace, mode);
+}
+
+MODULE_API void
+sr_set_monitor(const char *preset)
+{
+}
+
+MODULE_API void
+sr_set_rotation(unsigned char rotation)
+{
+}
+
+MODULE_API void
+sr_set_user_mode(int width, int height, int refresh)
+{
+}
+
+MODULE_API void
+sr_set_log_level(int level)
+{
+}
+
+MODULE_API void
+sr_set_log_callback_error(void *callback)
+{
+}
+
+MODULE_API void
+sr_set_log_callback_info(void *callback)
+{
+}
+
+MODULE_API void
+sr_set_log_callback_debug(void *callback)
+{
+}
+
+MODULE_API void
+sr_set_sdl_window(void *window)
+{
+}
+
+MODULE_API srAPI srlib = {
+    sr_init,
+    sr_load_ini,
+    sr_deinit,
+    sr_init_disp,
+    sr_add_mode,
+    sr_switch_to_mode,
+    sr_set_monitor,
+    sr_set_rotation,
+    sr_set_user_mode,
+    sr_set_log_level,
+    sr_set_log_callback_error,
+    sr_set_log_callback_info,
+    sr_set_log_callback_debug
+};
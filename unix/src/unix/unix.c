@@ -1,8 +1,11 @@
 #ifdef __linux__
+#    define _GNU_SOURCE
 #    define _FILE_OFFSET_BITS   64
 #    define _LARGEFILE64_SOURCE 1
 #endif
 #include <SDL.h>
+#include <pthread.h>
+#include <sched.h>
 #include <stdlib.h>
 #include <stdbool.h>
 #include <stdio.h>
@@ -12,20 +15,27 @@
 #include <sys/param.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <fcntl.h>
 #include <sys/mman.h>
 #include <unistd.h>
 #include <errno.h>
 #include <inttypes.h>
+#include <limits.h>
 #include <dlfcn.h>
 #include <wchar.h>
 #include <pwd.h>
 #include <stdatomic.h>
+#ifdef __linux__
+#    include <linux/futex.h>
+#    include <sys/syscall.h>
+#endif
 
 #include <86box/86box.h>
 #include <86box/mem.h>
 #include <86box/rom.h>
 #include <86box/keyboard.h>
 #include <86box/mouse.h>
+#include <86box/input_queue.h>
 #include <86box/config.h>
 #include <86box/path.h>
 #include <86box/plat.h>
@@ -35,11 +45,14 @@
 #include <86box/gameport.h>
 #include <86box/unix_sdl.h>
 #include <86box/unix_opengl.h> //psakhis
+#include <86box/unix_null.h>
+#include <86box/unix_evdev.h>
 #include <86box/timer.h>
 #include <86box/nvr.h>
 #include <86box/video.h>
 #include <86box/ui.h>
 #include <86box/gdbstub.h>
+#include <86box/harness.h>
 
 #ifdef __APPLE__
 #    include "macOSXGlue.h"
@@ -197,9 +210,10 @@ static const struct {
     void (*set_fs)(int fs);
     void (*reload)(void);
     void (*blit)(int x, int y, int w, int h);
-} vid_apis[2] = {    
+} vid_apis[3] = {    
     { "SDL_OpenGL", 1, (int (*)(void *)) sdl_initho, sdl_close, NULL, sdl_pause, NULL, sdl_set_fs, NULL, sdl_blit },
     { "OpenGL_Core", 1, (int (*)(void *)) opengl_init, opengl_close, NULL, opengl_pause, NULL, opengl_set_fs, NULL, opengl_blit },
+    { "Null", 1, null_init, null_close, NULL, null_pause, NULL, null_set_fs, NULL, null_blit },
   };
 
 
@@ -430,6 +444,13 @@ plat_munmap(void *ptr, size_t size)
     munmap(ptr, size);
 }
 
+void
+plat_mem_discard(void *ptr, size_t size)
+{
+    /* Anonymous pages read back as zero and fault in again on use. */
+    madvise(ptr, size, MADV_DONTNEED);
+}
+
 uint64_t
 plat_timer_read(void)
 {
@@ -468,6 +489,44 @@ plat_remove(char *path)
     remove(path);
 }
 
+/* Replace dst with src in one step, once src is safely on disk. */
+int
+plat_file_replace(const char *dst, const char *src)
+{
+    int fd = open(src, O_RDONLY);
+
+    if (fd < 0)
+        return -1;
+
+    fsync(fd);
+    close(fd);
+
+    return rename(src, dst);
+}
+
+/* Sleep while the int at addr still holds val, until plat_wake_all(addr).
+   May return early, callers check their condition again. */
+void
+plat_wait_on(void *addr, int val)
+{
+#ifdef __linux__
+    syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, val, NULL, NULL, 0);
+#else
+    struct timespec ts = { 0, 50000 };
+
+    if (*(volatile int *) addr == val)
+        nanosleep(&ts, NULL);
+#endif
+}
+
+void
+plat_wake_all(void *addr)
+{
+#ifdef __linux__
+    syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+#endif
+}
+
 void
 ui_sb_update_icon_state(int tag, int state)
 {
@@ -538,13 +597,58 @@ strnicmp(const char *s1, const char *s2, size_t n)
     return strncasecmp(s1, s2, n);
 }
 
+static const char     *thread_names[PLAT_THREADS] = { "emulation", "blit", "UI" };
+static __thread uint32_t thread_start_ms;
+
+/* Pin the calling thread to its configured core and give it the realtime policy. */
+void
+plat_thread_tune(int role)
+{
+    thread_start_ms = plat_get_ticks();
+
+#ifdef __linux__
+    if (thread_cpu[role] >= 0) {
+        cpu_set_t set;
+
+        CPU_ZERO(&set);
+        CPU_SET(thread_cpu[role], &set);
+        if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set))
+            pclog("Unable to pin the %s thread to CPU %i\n", thread_names[role], thread_cpu[role]);
+    }
+#endif
+
+    if (thread_fifo_prio) {
+        struct sched_param param = { .sched_priority = thread_fifo_prio };
+
+        if (pthread_setschedparam(pthread_self(), SCHED_FIFO, &param))
+            pclog("Unable to run the %s thread as SCHED_FIFO, CAP_SYS_NICE or an rtprio limit is needed\n", thread_names[role]);
+    }
+}
+
+/* Log the CPU time used by the calling thread over its lifetime. */
+void
+plat_thread_done(int role)
+{
+    struct timespec ts;
+    uint32_t        wall = plat_get_ticks() - thread_start_ms;
+    double          used;
+
+    if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts))
+        return;
+
+    used = (ts.tv_sec * 1000.0) + (ts.tv_nsec / 1000000.0);
+    pclog("Thread %s: %.0f ms CPU in %u ms (%.1f%%)\n", thread_names[role], used, wall,
+          wall ? (used * 100.0) / wall : 0.0);
+}
+
 void
 main_thread(void *param)
 {
     uint32_t old_time, new_time;
-    int      drawits, frames;
+    int      drawits, frames, ms;
 
     SDL_SetThreadPriority(SDL_THREAD_PRIORITY_HIGH);
+    plat_thread_tune(PLAT_THREAD_EMU);
     framecountx = 0;
     // title_update = 1;
     old_time = SDL_GetTicks();
@@ -559,23 +663,24 @@ main_thread(void *param)
 #endif
             drawits += (new_time - old_time);
         old_time = new_time;
-        if (drawits > 0 && !dopause) {
-            /* Yes, so do one frame now. */
-            drawits -= 10;
-            if (drawits > 50)
-                drawits = 0;
+        if (((drawits > 0) || speed_turbo) && !dopause) {
+            /* Yes, so run the time that is due now. */
+            ms = pc_speed_slice(&drawits);
 
             /* Run a block of code. */
-            pc_run();
+            pc_run(ms);
 
-            /* Every 200 frames we save the machine status. */
+            /* Every 200 frames we save the machine status. This only
+               takes a snapshot, the file is written on another thread. */
             if (++frames >= 200 && nvr_dosave) {
                 nvr_save();
                 nvr_dosave = 0;
                 frames     = 0;
             }
-        } else /* Just so we dont overload the host OS. */
+        } else {
+            /* Just so we dont overload the host OS. */
             SDL_Delay(1);
+        }
 
         /* If needed, handle a screen resize. */
         if (atomic_load(&doresize_monitors[0]) && !video_fullscreen && !is_quit) {
@@ -588,6 +693,8 @@ main_thread(void *param)
     }
 
     is_quit = 1;
+
+    plat_thread_done(PLAT_THREAD_EMU);
 }
 
 thread_t *thMain = NULL;
@@ -700,6 +807,9 @@ plat_power_off(void)
     nvr_save();
     config_save();
 
+    /* pc_close() is not reached on this path, so write it out now. */
+    config_flush();
+
     /* Deduct a sufficiently large number of cycles that no instructions will
        run before the main thread is terminated */
     cycles -= 99999999;
@@ -713,23 +823,16 @@ ui_sb_bugui(char *str)
 }
 
 extern void sdl_blit(int x, int y, int w, int h);
+extern void sdl_joystick_event(SDL_Event *event);
+
+static input_queue_t ui_input;
+static input_queue_t monitor_input; /* Keys typed from the monitor console or a script. */
+static int           raw_input = 0; /* Keyboard and mouse come from evdev, not SDL. */
 
-typedef struct mouseinputdata {
-    int deltax, deltay, deltaz;
-    int mousebuttons;
-} mouseinputdata;
-SDL_mutex            *mousemutex;
-static mouseinputdata mousedata;
 void
 mouse_poll(void)
 {
-    SDL_LockMutex(mousemutex);
-    mouse_x          = mousedata.deltax;
-    mouse_y          = mousedata.deltay;
-    mouse_z          = mousedata.deltaz;
-    mousedata.deltax = mousedata.deltay = mousedata.deltaz = 0;
-    mouse_buttons                                          = mousedata.mousebuttons;
-    SDL_UnlockMutex(mousemutex);
+    input_queue_mouse_poll(&mouse_x, &mouse_y, &mouse_z, &mouse_buttons);
 }
 
 int real_sdl_w, real_sdl_h;
@@ -900,14 +1003,18 @@ void
 monitor_thread(void *param)
 {
 #ifndef USE_CLI
-    if (isatty(fileno(stdin)) && isatty(fileno(stdout))) {
+    if (harness_scripted() || (isatty(fileno(stdin)) && isatty(fileno(stdout)))) {
         char  *line = NULL;
         size_t n;
         printf("86Box monitor console.\n");
         while (!exit_event) {
-            if (feof(stdin))
+            if (harness_scripted()) {
+                /* Commands come from the script instead, at their emulated time. */
+                if (!(line = harness_script_next()))
+                    break;
+            } else if (feof(stdin))
                 break;
-            if (f_readline)
+            else if (f_readline)
                 line = f_readline("(86Box) ");
             else {
                 printf("(86Box) ");
@@ -944,8 +1051,10 @@ monitor_thread(void *param)
                         "zipeject <id> - eject ZIP image from ZIP drive <id>.\n"
                         "carteject <id> - eject cartridge from drive <id>.\n"
                         "moeject <id> - eject image from MO drive <id>.\n\n"
+                        "key <scancode> [down|up] - press and/or release a key, scancode in hex.\n\n"
                         "hardreset - hard reset the emulated system.\n"
                         "pause - pause the the emulated system.\n"
+                        "turbo - toggle running unthrottled, skipping frames.\n"
                         "fullscreen - toggle fullscreen.\n"
                         "exit - exit 86Box.\n");
                 } else if (strncasecmp(xargv[0], "exit", 4) == 0) {
@@ -956,6 +1065,16 @@ monitor_thread(void *param)
                 } else if (strncasecmp(xargv[0], "pause", 5) == 0) {
                     plat_pause(dopause ^ 1);
                     printf("%s", dopause ? "Paused.\n" : "Unpaused.\n");
+                } else if (strncasecmp(xargv[0], "key", 3) == 0 && cmdargc >= 2) {
+                    uint16_t scancode = strtoul(xargv[1], NULL, 16);
+
+                    if ((cmdargc < 3) || !strcasecmp(xargv[2], "down"))
+                        input_queue_key(&monitor_input, 1, scancode);
+                    if ((cmdargc < 3) || !strcasecmp(xargv[2], "up"))
+                        input_queue_key(&monitor_input, 0, scancode);
+                } else if (strncasecmp(xargv[0], "turbo", 5) == 0) {
+                    speed_turbo ^= 1;
+                    printf("%s", speed_turbo ? "Turbo on.\n" : "Turbo off.\n");
                 } else if (strncasecmp(xargv[0], "hardreset", 9) == 0) {
                     pc_reset_hard();
                 } else if (strncasecmp(xargv[0], "cdload", 6) == 0 && cmdargc >= 3) {
@@ -1092,6 +1211,7 @@ monitor_thread(void *param)
                 line = NULL;
             }
         }
+        harness_script_stop();
     }
 #endif
 }
@@ -1128,16 +1248,23 @@ main(int argc, char **argv)
         f_rl_callback_handler_remove = dlsym(libedithandle, "rl_callback_handler_remove");
     } else
         fprintf(stderr, "libedit not found, line editing will be limited.\n");
-    mousemutex = SDL_CreateMutex();
+    input_queue_register(&ui_input);
+    input_queue_register(&monitor_input);
+#ifdef __linux__
+    if (input_evdev)
+        raw_input = evdev_init();
+#endif
     
     //psakhis: start on fullscreen
     video_fullscreen = 1; 
     //sdl_initho();
     if (!vid_apis[vid_api].init(NULL))    
      return -1;   
+    pc_startup_stage("renderer");
                 
     /* Fire up the machine. */
     pc_reset_hard_init();
+    pc_startup_stage("machine");
 
     /* Set the PAUSE mode depending on the renderer. */
     // plat_pause(0);
@@ -1148,6 +1275,7 @@ main(int argc, char **argv)
 #ifndef USE_CLI
     thread_create(monitor_thread, NULL);
 #endif
+    plat_thread_tune(PLAT_THREAD_UI);
     SDL_AddTimer(1000, timer_onesec, NULL);
     while (!is_quit) {
         static int mouse_inside = 0;
@@ -1163,19 +1291,15 @@ main(int argc, char **argv)
                                 event.wheel.x *= -1;
                                 event.wheel.y *= -1;
                             }
-                            SDL_LockMutex(mousemutex);
-                            mousedata.deltaz = event.wheel.y;
-                            SDL_UnlockMutex(mousemutex);
+                            if (!raw_input)
+                                input_queue_mouse_wheel(&ui_input, event.wheel.y);
                         }
                         break;
                     }
                 case SDL_MOUSEMOTION:
                     {
-                        if (mouse_capture || video_fullscreen) {
-                            SDL_LockMutex(mousemutex);
-                            mousedata.deltax += event.motion.xrel;
-                            mousedata.deltay += event.motion.yrel;
-                            SDL_UnlockMutex(mousemutex);
+                        if ((mouse_capture || video_fullscreen) && !raw_input) {
+                            input_queue_mouse_move(&ui_input, event.motion.xrel, event.motion.yrel);
                         }
                         break;
                     }
@@ -1200,7 +1324,7 @@ main(int argc, char **argv)
                             plat_mouse_capture(0);
                             break;
                         }
-                        if (mouse_capture || video_fullscreen) {
+                        if ((mouse_capture || video_fullscreen) && !raw_input) {
                             int buttonmask = 0;
 
                             switch (event.button.button) {
@@ -1220,15 +1344,18 @@ main(int argc, char **argv)
                                     buttonmask = 16;
                                     break;
                             }
-                            SDL_LockMutex(mousemutex);
-                            if (event.button.state == SDL_PRESSED) {
-                                mousedata.mousebuttons |= buttonmask;
-                            } else
-                                mousedata.mousebuttons &= ~buttonmask;
-                            SDL_UnlockMutex(mousemutex);
+                            input_queue_mouse_button(&ui_input, buttonmask, event.button.state == SDL_PRESSED);
                         }
                         break;
                     }
+                case SDL_JOYAXISMOTION:
+                case SDL_JOYBUTTONDOWN:
+                case SDL_JOYBUTTONUP:
+                case SDL_JOYHATMOTION:
+                case SDL_JOYDEVICEADDED:
+                case SDL_JOYDEVICEREMOVED:
+                    sdl_joystick_event(&event);
+                    break;
                 case SDL_RENDER_DEVICE_RESET:
                 case SDL_RENDER_TARGETS_RESET:
                     {
@@ -1245,7 +1372,8 @@ main(int argc, char **argv)
                                 xtkey = sdl_to_xt[event.key.keysym.scancode];
                                 break;
                         }
-                        keyboard_input(event.key.state == SDL_PRESSED, xtkey);
+                        if (!raw_input)
+                            input_queue_key(&ui_input, event.key.state == SDL_PRESSED, xtkey);
                     }
                 case SDL_WINDOWEVENT:
                     {
@@ -1286,13 +1414,17 @@ main(int argc, char **argv)
             break;
         }
     }
+    plat_thread_done(PLAT_THREAD_UI);
     printf("\n");
+#ifdef __linux__
+    if (raw_input)
+        evdev_close();
+#endif
     SDL_DestroyMutex(blitmtx);
-    SDL_DestroyMutex(mousemutex);
     SDL_Quit();
     if (f_rl_callback_handler_remove)
         f_rl_callback_handler_remove();
-    return 0;
+    return harness_close() ? 1 : 0;
 }
 
 /* Return the VIDAPI number for the given name. */
@@ -1305,7 +1437,7 @@ plat_vidapi(char *name)
     if (!strcasecmp(name, "default") || !strcasecmp(name, "system") || !strcasecmp(name, "sdl"))
         return (0);  
 
-    for (i = 0; i < 2; i++) {
+    for (i = 0; i < 3; i++) {
         if (vid_apis[i].name && !strcasecmp(vid_apis[i].name, name))
             return (i);
     }
@@ -1328,6 +1460,9 @@ plat_vidapi_name(int api)
         case 1:
             name = "opengl_core";
             break;     
+        case 2:
+            name = "null";
+            break;
         default:
             fatal("Unknown renderer: %i\n", api);
             break;
@@ -0,0 +1,458 @@
+/*
+ * 86Box    A hypervisor and IBM PC system emulator that specializes in
+ *          running old operating systems and software designed for IBM
+ *          PC systems and compatibles from 1981 through fairly recent
+ *          system designs based on the PCI bus.
+ *
+ *          This file is part of the 86Box distribution.
+ *
+ *          Linux evdev input reader.
+ *
+ *          A dedicated thread reads keyboards and mice straight from
+ *          /dev/input/event* through epoll and pushes their events into
+ *          its own input queue, so input latency does not depend on how
+ *          often the SDL event loop gets to run between blits. Devices
+ *          that appear later are picked up through inotify.
+ */
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <wchar.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <sys/ioctl.h>
+#include <linux/input.h>
+
+#include <86box/86box.h>
+#include <86box/plat.h>
+#include <86box/thread.h>
+#include <86box/input_queue.h>
+#include <86box/unix_evdev.h>
+
+#define EVDEV_DIR         "/dev/input"
+#define EVDEV_MAX_DEVICES 32
+
+/* epoll tags that are not device slots. */
+#define EVDEV_TAG_STOP    0xffff
+#define EVDEV_TAG_HOTPLUG 0xfffe
+
+#define BITS_PER_LONG       (sizeof(unsigned long) * 8)
+#define NBITS(n)            (((n) + BITS_PER_LONG - 1) / BITS_PER_LONG)
+#define TEST_BIT(bit, arr)  (((arr)[(bit) / BITS_PER_LONG] >> ((bit) % BITS_PER_LONG)) & 1)
+
+static const uint16_t evdev_to_xt[0x100] = {
+    [KEY_ESC]        = 0x01,
+    [KEY_1]          = 0x02,
+    [KEY_2]          = 0x03,
+    [KEY_3]          = 0x04,
+    [KEY_4]          = 0x05,
+    [KEY_5]          = 0x06,
+    [KEY_6]          = 0x07,
+    [KEY_7]          = 0x08,
+    [KEY_8]          = 0x09,
+    [KEY_9]          = 0x0A,
+    [KEY_0]          = 0x0B,
+    [KEY_MINUS]      = 0x0C,
+    [KEY_EQUAL]      = 0x0D,
+    [KEY_BACKSPACE]  = 0x0E,
+    [KEY_TAB]        = 0x0F,
+    [KEY_Q]          = 0x10,
+    [KEY_W]          = 0x11,
+    [KEY_E]          = 0x12,
+    [KEY_R]          = 0x13,
+    [KEY_T]          = 0x14,
+    [KEY_Y]          = 0x15,
+    [KEY_U]          = 0x16,
+    [KEY_I]          = 0x17,
+    [KEY_O]          = 0x18,
+    [KEY_P]          = 0x19,
+    [KEY_LEFTBRACE]  = 0x1A,
+    [KEY_RIGHTBRACE] = 0x1B,
+    [KEY_ENTER]      = 0x1C,
+    [KEY_LEFTCTRL]   = 0x1D,
+    [KEY_A]          = 0x1E,
+    [KEY_S]          = 0x1F,
+    [KEY_D]          = 0x20,
+    [KEY_F]          = 0x21,
+    [KEY_G]          = 0x22,
+    [KEY_H]          = 0x23,
+    [KEY_J]          = 0x24,
+    [KEY_K]          = 0x25,
+    [KEY_L]          = 0x26,
+    [KEY_SEMICOLON]  = 0x27,
+    [KEY_APOSTROPHE] = 0x28,
+    [KEY_GRAVE]      = 0x29,
+    [KEY_LEFTSHIFT]  = 0x2A,
+    [KEY_BACKSLASH]  = 0x2B,
+    [KEY_Z]          = 0x2C,
+    [KEY_X]          = 0x2D,
+    [KEY_C]          = 0x2E,
+    [KEY_V]          = 0x2F,
+    [KEY_B]          = 0x30,
+    [KEY_N]          = 0x31,
+    [KEY_M]          = 0x32,
+    [KEY_COMMA]      = 0x33,
+    [KEY_DOT]        = 0x34,
+    [KEY_SLASH]      = 0x35,
+    [KEY_RIGHTSHIFT] = 0x36,
+    [KEY_KPASTERISK] = 0x37,
+    [KEY_LEFTALT]    = 0x38,
+    [KEY_SPACE]      = 0x39,
+    [KEY_CAPSLOCK]   = 0x3A,
+    [KEY_F1]         = 0x3B,
+    [KEY_F2]         = 0x3C,
+    [KEY_F3]         = 0x3D,
+    [KEY_F4]         = 0x3E,
+    [KEY_F5]         = 0x3F,
+    [KEY_F6]         = 0x40,
+    [KEY_F7]         = 0x41,
+    [KEY_F8]         = 0x42,
+    [KEY_F9]         = 0x43,
+    [KEY_F10]        = 0x44,
+    [KEY_NUMLOCK]    = 0x45,
+    [KEY_SCROLLLOCK] = 0x46,
+    [KEY_HOME]       = 0x147,
+    [KEY_UP]         = 0x148,
+    [KEY_PAGEUP]     = 0x149,
+    [KEY_KPMINUS]    = 0x4A,
+    [KEY_LEFT]       = 0x14B,
+    [KEY_KP5]        = 0x4C,
+    [KEY_RIGHT]      = 0x14D,
+    [KEY_KPPLUS]     = 0x4E,
+    [KEY_END]        = 0x14F,
+    [KEY_DOWN]       = 0x150,
+    [KEY_PAGEDOWN]   = 0x151,
+    [KEY_INSERT]     = 0x152,
+    [KEY_DELETE]     = 0x153,
+    [KEY_102ND]      = 0x56,
+    [KEY_F11]        = 0x57,
+    [KEY_F12]        = 0x58,
+
+    [KEY_KPENTER]   = 0x11c,
+    [KEY_RIGHTCTRL] = 0x11d,
+    [KEY_KPSLASH]   = 0x135,
+    [KEY_RIGHTALT]  = 0x138,
+    [KEY_KP9]       = 0x49,
+    [KEY_KP8]       = 0x48,
+    [KEY_KP7]       = 0x47,
+    [KEY_KP6]       = 0x4D,
+    [KEY_KP4]       = 0x4B,
+    [KEY_KP3]       = 0x51,
+    [KEY_KP2]       = 0x50,
+    [KEY_KP1]       = 0x4F,
+    [KEY_KP0]       = 0x52,
+    [KEY_KPDOT]     = 0x53,
+
+    [KEY_LEFTMETA]  = 0x15B,
+    [KEY_RIGHTMETA] = 0x15C,
+    [KEY_COMPOSE]   = 0x15D,
+    [KEY_SYSRQ]     = 0x137
+};
+
+typedef struct evdev_device_t {
+    int  fd;
+    int  dx, dy; /* Relative motion since the last SYN_REPORT. */
+    char path[64];
+} evdev_device_t;
+
+static struct {
+    int            epfd;
+    int            stopfd;
+    int            inofd;
+    thread_t      *thread;
+    input_queue_t  queue;
+    evdev_device_t dev[EVDEV_MAX_DEVICES];
+} evdev = { .epfd = -1, .stopfd = -1, .inofd = -1 };
+
+#ifdef ENABLE_EVDEV_LOG
+int evdev_do_log = ENABLE_EVDEV_LOG;
+
+static void
+evdev_log(const char *fmt, ...)
+{
+    va_list ap;
+
+    if (evdev_do_log) {
+        va_start(ap, fmt);
+        pclog_ex(fmt, ap);
+        va_end(ap);
+    }
+}
+#else
+#    define evdev_log(fmt, ...)
+#endif
+
+/* Only keyboards and mice are read here, joysticks stay with SDL. */
+static int
+evdev_is_input(int fd)
+{
+    unsigned long ev[NBITS(EV_MAX + 1)]   = { 0 };
+    unsigned long key[NBITS(KEY_MAX + 1)] = { 0 };
+    unsigned long rel[NBITS(REL_MAX + 1)] = { 0 };
+
+    if (ioctl(fd, EVIOCGBIT(0, sizeof(ev)), ev) < 0)
+        return 0;
+    if (!TEST_BIT(EV_KEY, ev))
+        return 0;
+    ioctl(fd, EVIOCGBIT(EV_KEY, sizeof(key)), key);
+
+    if (TEST_BIT(KEY_A, key) && TEST_BIT(KEY_ENTER, key))
+        return 1;
+
+    if (TEST_BIT(EV_REL, ev)) {
+        ioctl(fd, EVIOCGBIT(EV_REL, sizeof(rel)), rel);
+        if (TEST_BIT(REL_X, rel) && TEST_BIT(REL_Y, rel) && TEST_BIT(BTN_LEFT, key))
+            return 1;
+    }
+
+    return 0;
+}
+
+static void
+evdev_open(const char *name)
+{
+    struct epoll_event ev = { .events = EPOLLIN };
+    char               path[64];
+    char               dev_name[256] = "";
+    int                slot          = -1;
+    int                fd;
+
+    if (strncmp(name, "event", 5))
+        return;
+    snprintf(path, sizeof(path), EVDEV_DIR "/%s", name);
+
+    for (int i = 0; i < EVDEV_MAX_DEVICES; i++) {
+        if (evdev.dev[i].fd < 0) {
+            if (slot < 0)
+                slot = i;
+        } else if (!strcmp(evdev.dev[i].path, path))
+            return;
+    }
+    if (slot < 0)
+        return;
+
+    fd = open(path, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+    if (fd < 0) {
+        evdev_log("evdev: unable to open %s (%s)\n", path, strerror(errno));
+        return;
+    }
+
+    if (!evdev_is_input(fd)) {
+        close(fd);
+        return;
+    }
+
+    ev.data.u32 = slot;
+    if (epoll_ctl(evdev.epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        close(fd);
+        return;
+    }
+
+    ioctl(fd, EVIOCGNAME(sizeof(dev_name)), dev_name);
+    pclog("evdev: reading %s (%s)\n", path, dev_name);
+
+    evdev.dev[slot].fd = fd;
+    evdev.dev[slot].dx = evdev.dev[slot].dy = 0;
+    snprintf(evdev.dev[slot].path, sizeof(evdev.dev[slot].path), "%s", path);
+}
+
+static void
+evdev_remove(int slot)
+{
+    pclog("evdev: %s removed\n", evdev.dev[slot].path);
+
+    epoll_ctl(evdev.epfd, EPOLL_CTL_DEL, evdev.dev[slot].fd, NULL);
+    close(evdev.dev[slot].fd);
+    evdev.dev[slot].fd = -1;
+}
+
+static void
+evdev_scan(void)
+{
+    DIR           *dir = opendir(EVDEV_DIR);
+    struct dirent *de;
+
+    if (dir == NULL)
+        return;
+
+    while ((de = readdir(dir)) != NULL)
+        evdev_open(de->d_name);
+
+    closedir(dir);
+}
+
+static void
+evdev_hotplug(void)
+{
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+
+    ssize_t len = read(evdev.inofd, buf, sizeof(buf));
+
+    for (char *ptr = buf; ptr < buf + len;) {
+        const struct inotify_event *event = (const struct inotify_event *) ptr;
+
+        if (event->len)
+            evdev_open(event->name);
+
+        ptr += sizeof(struct inotify_event) + event->len;
+    }
+}
+
+static void
+evdev_event(evdev_device_t *dev, const struct input_event *ie)
+{
+    /* Same rule as the SDL path, the mouse only belongs to the guest when captured. */
+    int mouse = mouse_capture || video_fullscreen;
+
+    switch (ie->type) {
+        case EV_KEY:
+            if (ie->code < 0x100 && evdev_to_xt[ie->code]) {
+                /* Autorepeat (2) counts as a press, as SDL_KEYDOWN repeats do. */
+                input_queue_key(&evdev.queue, ie->value != 0, evdev_to_xt[ie->code]);
+            } else if (mouse && ie->code >= BTN_LEFT && ie->code <= BTN_EXTRA) {
+                static const int buttonmask[] = { 1, 2, 4, 8, 16 };
+
+                input_queue_mouse_button(&evdev.queue, buttonmask[ie->code - BTN_LEFT], ie->value != 0);
+            }
+            break;
+
+        case EV_REL:
+            if (!mouse)
+                break;
+            if (ie->code == REL_X)
+                dev->dx += ie->value;
+            else if (ie->code == REL_Y)
+                dev->dy += ie->value;
+            else if (ie->code == REL_WHEEL)
+                input_queue_mouse_wheel(&evdev.queue, ie->value);
+            break;
+
+        case EV_SYN:
+            if (ie->code == SYN_REPORT && (dev->dx || dev->dy)) {
+                input_queue_mouse_move(&evdev.queue, dev->dx, dev->dy);
+                dev->dx = dev->dy = 0;
+            }
+            break;
+    }
+}
+
+static void
+evdev_read(int slot)
+{
+    struct input_event ie[64];
+    ssize_t            len;
+
+    while ((len = read(evdev.dev[slot].fd, ie, sizeof(ie))) > 0) {
+        for (int i = 0; i < (int) (len / sizeof(struct input_event)); i++)
+            evdev_event(&evdev.dev[slot], &ie[i]);
+    }
+
+    if (len < 0 && errno != EAGAIN && errno != EINTR)
+        evdev_remove(slot);
+}
+
+static void
+evdev_thread(void *param)
+{
+    struct epoll_event events[16];
+
+    while (1) {
+        int n = epoll_wait(evdev.epfd, events, 16, -1);
+
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            pclog("evdev: epoll_wait failed (%s)\n", strerror(errno));
+            return;
+        }
+
+        for (int i = 0; i < n; i++) {
+            uint32_t tag = events[i].data.u32;
+
+            if (tag == EVDEV_TAG_STOP)
+                return;
+            else if (tag == EVDEV_TAG_HOTPLUG)
+                evdev_hotplug();
+            else if (evdev.dev[tag].fd >= 0)
+                evdev_read(tag);
+        }
+    }
+}
+
+/* Start reading input devices, returns 0 if none could be opened. */
+int
+evdev_init(void)
+{
+    struct epoll_event ev = { .events = EPOLLIN };
+    int                opened = 0;
+
+    for (int i = 0; i < EVDEV_MAX_DEVICES; i++)
+        evdev.dev[i].fd = -1;
+
+    evdev.epfd   = epoll_create1(EPOLL_CLOEXEC);
+    evdev.stopfd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (evdev.epfd < 0 || evdev.stopfd < 0) {
+        pclog("evdev: unable to set up epoll (%s)\n", strerror(errno));
+        evdev_close();
+        return 0;
+    }
+
+    ev.data.u32 = EVDEV_TAG_STOP;
+    epoll_ctl(evdev.epfd, EPOLL_CTL_ADD, evdev.stopfd, &ev);
+
+    /* udev fixes up permissions after creating the node, so retry on IN_ATTRIB. */
+    evdev.inofd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (evdev.inofd >= 0 && inotify_add_watch(evdev.inofd, EVDEV_DIR, IN_CREATE | IN_ATTRIB) >= 0) {
+        ev.data.u32 = EVDEV_TAG_HOTPLUG;
+        epoll_ctl(evdev.epfd, EPOLL_CTL_ADD, evdev.inofd, &ev);
+    }
+
+    evdev_scan();
+
+    for (int i = 0; i < EVDEV_MAX_DEVICES; i++)
+        opened += (evdev.dev[i].fd >= 0);
+
+    if (!opened) {
+        pclog("evdev: no readable keyboard or mouse in " EVDEV_DIR ", using SDL input\n");
+        evdev_close();
+        return 0;
+    }
+
+    input_queue_register(&evdev.queue);
+    evdev.thread = thread_create(evdev_thread, NULL);
+
+    return 1;
+}
+
+void
+evdev_close(void)
+{
+    if (evdev.thread) {
+        uint64_t one = 1;
+
+        if (write(evdev.stopfd, &one, sizeof(one)) == sizeof(one))
+            thread_wait(evdev.thread);
+        evdev.thread = NULL;
+    }
+
+    for (int i = 0; i < EVDEV_MAX_DEVICES; i++) {
+        if (evdev.dev[i].fd >= 0)
+            close(evdev.dev[i].fd);
+        evdev.dev[i].fd = -1;
+    }
+
+    if (evdev.inofd >= 0)
+        close(evdev.inofd);
+    if (evdev.stopfd >= 0)
+        close(evdev.stopfd);
+    if (evdev.epfd >= 0)
+        close(evdev.epfd);
+    evdev.inofd = evdev.stopfd = evdev.epfd = -1;
+}
@@ -0,0 +1,161 @@
+/*
+ * 86Box    A hypervisor and IBM PC system emulator that specializes in
+ *          running old operating systems and software designed for IBM
+ *          PC systems and compatibles from 1981 through fairly recent
+ *          system designs based on the PCI bus.
+ *
+ *          This file is part of the 86Box distribution.
+ *
+ *          Null rendering module.
+ *
+ *          Takes frames from the blit thread without opening a window,
+ *          so emulation throughput can be measured (and profiled) on a
+ *          machine with no display or GPU. Depending on video_null_mode
+ *          frames are dropped, copied into a private buffer like a
+ *          renderer's upload would, or hashed.
+ *
+ *          If switchres accepts a display without a window, as the stub
+ *          libswitchres does, mode switches go through it and are timed
+ *          like in the other renderers, up to the first frame handled in
+ *          the new mode.
+ */
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wchar.h>
+
+#include <86box/86box.h>
+#include <86box/plat.h>
+#include <86box/video.h>
+#include <86box/unix_null.h>
+#include <86box/switchres_wrapper.h>
+
+static struct {
+    int       enabled;
+    uint32_t *pixels; /* NULL_MODE_COPY destination, grown as needed. */
+    size_t    size;
+    uint64_t  hash;
+    uint32_t  frames;
+    uint32_t  start;
+    int       switchres; /* sr_init_disp() took a display without a window. */
+} null_state;
+
+extern int blitreq;
+
+static void
+null_blit_shim(int x, int y, int w, int h, int monitor_index)
+{
+    if ((x < 0) || (y < 0) || (w <= 0) || (h <= 0) || (w > 2048) || (h > 2048) || (blit_buffer32 == NULL) || !null_state.enabled || (monitor_index >= 1)) {
+        video_blit_complete_monitor(monitor_index);
+        return;
+    }
+
+    if (switchres_switch) {
+        sr_mode mode;
+
+        if (null_state.switchres) {
+            /* Same line counts as the other renderers ask for. */
+            switchres_stats_begin();
+            sr_switch_to_mode(switchres_width, switchres_interlace ? 480 : 240, switchres_freq, switchres_interlace, &mode);
+        }
+
+        switchres_switch = 0;
+    }
+
+    switch (video_null_mode) {
+        case NULL_MODE_COPY:
+            if (null_state.size < (size_t) w * h) {
+                free(null_state.pixels);
+                null_state.size   = (size_t) w * h;
+                null_state.pixels = malloc(null_state.size * sizeof(uint32_t));
+                if (null_state.pixels == NULL) {
+                    null_state.size = 0;
+                    break;
+                }
+            }
+            for (int row = 0; row < h; row++)
+                video_copy(&null_state.pixels[row * w], &(blit_buffer32->line[y + row][x]), w * sizeof(uint32_t));
+            break;
+
+        case NULL_MODE_HASH:
+            /* FNV-1a over whole pixels, chained across frames. */
+            for (int row = 0; row < h; row++) {
+                const uint32_t *p = &(blit_buffer32->line[y + row][x]);
+
+                for (int col = 0; col < w; col++)
+                    null_state.hash = (null_state.hash ^ p[col]) * 0x100000001b3ULL;
+            }
+            break;
+
+        default:
+            break;
+    }
+
+    null_state.frames++;
+
+    /* Completes a switch begun above, once the frame is handled. */
+    switchres_stats_end();
+
+    video_blit_complete_monitor(monitor_index);
+}
+
+int
+null_init(void *param)
+{
+    null_state.hash   = 0xcbf29ce484222325ULL;
+    null_state.frames = 0;
+    null_state.start  = plat_get_ticks();
+
+    sr_init();
+    null_state.switchres = sr_init_disp("auto", NULL);
+    if (null_state.switchres)
+        atexit(sr_deinit);
+
+    video_setblit(null_blit_shim);
+    null_state.enabled = 1;
+
+    pclog("Null renderer: mode %i, switchres %s\n", video_null_mode, null_state.switchres ? "on" : "off");
+
+    return 1;
+}
+
+void
+null_close(void)
+{
+    uint32_t ms = plat_get_ticks() - null_state.start;
+
+    if (!null_state.enabled)
+        return;
+
+    video_setblit(NULL);
+    null_state.enabled = 0;
+
+    pclog("Null renderer: %u frames in %u ms (%.2f frames/s)\n", null_state.frames, ms,
+          ms ? (null_state.frames * 1000.0) / ms : 0.0);
+    if (video_null_mode == NULL_MODE_HASH)
+        pclog("Null renderer: frame hash %016llx\n", (unsigned long long) null_state.hash);
+
+    free(null_state.pixels);
+    null_state.pixels = NULL;
+    null_state.size   = 0;
+}
+
+int
+null_pause(void)
+{
+    return 0;
+}
+
+void
+null_set_fs(int fs)
+{
+}
+
+void
+null_blit(int x, int y, int w, int h)
+{
+    blitreq = 0;
+}
@@ -1,4 +1,6 @@
+#include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 #include <math.h>
 #include <SDL2/SDL.h>
 
@@ -6,151 +8,333 @@
 #include <86box/device.h>
 #include <86box/plat.h>
 #include <86box/gameport.h>
+#include <86box/input_queue.h>
+
+#define JOY_AXES    8
+#define JOY_BUTTONS 16
+#define JOY_HATS    4
 
 int joysticks_present;
 joystick_t joystick_state[MAX_JOYSTICKS];
 
 plat_joystick_t plat_joystick_state[MAX_PLAT_JOYSTICKS];
-static SDL_Joystick *sdl_joy[MAX_PLAT_JOYSTICKS];
+
+/* Devices are opened and closed on the UI thread, which turns their SDL
+   events into input queue events. plat_joystick_state is only updated
+   from those events, on the emulation thread. */
+static SDL_Joystick  *sdl_joy[MAX_PLAT_JOYSTICKS];
+static SDL_JoystickID sdl_joy_id[MAX_PLAT_JOYSTICKS];
+static input_queue_t  joy_input;
+
+/* Set when plat_joystick_state changed since the last joystick_process(). */
+static int joystick_dirty;
+
+/* The mapping joystick_state was last filled with, see joystick_remapped(). */
+static int        mapped_type = -1;
+static joystick_t mapped[MAX_JOYSTICKS];
+
+/* POV angle for every SDL hat value, -1 when centered. */
+static int hat_pov[16];
+
+static int hat_x(int hat)
+{
+        switch (hat)
+        {
+                case SDL_HAT_LEFTUP: case SDL_HAT_LEFT: case SDL_HAT_LEFTDOWN:
+                return -32767;
+
+                case SDL_HAT_RIGHTUP: case SDL_HAT_RIGHT: case SDL_HAT_RIGHTDOWN:
+                return 32767;
+
+                default:
+                return 0;
+        }
+}
+
+static int hat_y(int hat)
+{
+        switch (hat)
+        {
+                case SDL_HAT_LEFTUP: case SDL_HAT_UP: case SDL_HAT_RIGHTUP:
+                return -32767;
+
+                case SDL_HAT_LEFTDOWN: case SDL_HAT_DOWN: case SDL_HAT_RIGHTDOWN:
+                return 32767;
+
+                default:
+                return 0;
+        }
+}
+
+static int pov_angle(int x, int y)
+{
+        double angle;
+
+        if (((int64_t)x * x + (int64_t)y * y) < (16384 * 16384))
+                return -1;
+
+        angle = (atan2((double)y, (double)x) * 360.0) / (2*M_PI);
+
+        return ((int)angle + 90 + 360) % 360;
+}
+
+static int joystick_slot(SDL_JoystickID id)
+{
+        int c;
+
+        for (c = 0; c < MAX_PLAT_JOYSTICKS; c++)
+        {
+                if (sdl_joy[c] && (sdl_joy_id[c] == id))
+                        return c;
+        }
+
+        return -1;
+}
+
+static void joystick_open(int index)
+{
+        int c, d;
+
+        if (joystick_slot(SDL_JoystickGetDeviceInstanceID(index)) >= 0)
+                return;
+
+        /* Reuse the first free slot, so a device plugged back in keeps its number. */
+        for (c = 0; c < MAX_PLAT_JOYSTICKS; c++)
+        {
+                if (!sdl_joy[c])
+                        break;
+        }
+        if (c == MAX_PLAT_JOYSTICKS)
+                return;
+
+        sdl_joy[c] = SDL_JoystickOpen(index);
+        if (!sdl_joy[c])
+                return;
+        sdl_joy_id[c] = SDL_JoystickInstanceID(sdl_joy[c]);
+
+        pclog("Opened Joystick %i\n", c);
+        pclog(" Name: %s\n", SDL_JoystickName(sdl_joy[c]));
+        pclog(" Number of Axes: %d\n", SDL_JoystickNumAxes(sdl_joy[c]));
+        pclog(" Number of Buttons: %d\n", SDL_JoystickNumButtons(sdl_joy[c]));
+        pclog(" Number of Hats: %d\n", SDL_JoystickNumHats(sdl_joy[c]));
+
+        strncpy(plat_joystick_state[c].name, SDL_JoystickNameForIndex(index), 64);
+        plat_joystick_state[c].nr_axes = SDL_JoystickNumAxes(sdl_joy[c]);
+        plat_joystick_state[c].nr_buttons = SDL_JoystickNumButtons(sdl_joy[c]);
+        plat_joystick_state[c].nr_povs = SDL_JoystickNumHats(sdl_joy[c]);
+
+        for (d = 0; d < MIN(plat_joystick_state[c].nr_axes, 8); d++)
+        {
+                sprintf(plat_joystick_state[c].axis[d].name, "Axis %i", d);
+                plat_joystick_state[c].axis[d].id = d;
+        }
+        for (d = 0; d < MIN(plat_joystick_state[c].nr_buttons, 8); d++)
+        {
+                sprintf(plat_joystick_state[c].button[d].name, "Button %i", d);
+                plat_joystick_state[c].button[d].id = d;
+        }
+        for (d = 0; d < MIN(plat_joystick_state[c].nr_povs, 4); d++)
+        {
+                sprintf(plat_joystick_state[c].pov[d].name, "POV %i", d);
+                plat_joystick_state[c].pov[d].id = d;
+        }
+
+        if (c >= joysticks_present)
+                joysticks_present = c + 1;
+
+        /* Events only report changes, so start from the current position. */
+        input_queue_push(&joy_input, INPUT_EVENT_JOY_DEVICE, c, 0, 1, 0);
+        for (d = 0; d < MIN(plat_joystick_state[c].nr_axes, JOY_AXES); d++)
+                input_queue_push(&joy_input, INPUT_EVENT_JOY_AXIS, c, d, SDL_JoystickGetAxis(sdl_joy[c], d), 0);
+        for (d = 0; d < MIN(plat_joystick_state[c].nr_buttons, JOY_BUTTONS); d++)
+                input_queue_push(&joy_input, INPUT_EVENT_JOY_BUTTON, c, d, SDL_JoystickGetButton(sdl_joy[c], d), 0);
+        for (d = 0; d < MIN(plat_joystick_state[c].nr_povs, JOY_HATS); d++)
+                input_queue_push(&joy_input, INPUT_EVENT_JOY_HAT, c, d, SDL_JoystickGetHat(sdl_joy[c], d), 0);
+}
+
+static void joystick_remove(SDL_JoystickID id)
+{
+        int c = joystick_slot(id);
+
+        if (c < 0)
+                return;
+
+        pclog("Closed Joystick %i\n", c);
+
+        SDL_JoystickClose(sdl_joy[c]);
+        sdl_joy[c] = NULL;
+
+        input_queue_push(&joy_input, INPUT_EVENT_JOY_DEVICE, c, 0, 0, 0);
+}
+
+/* Called by the UI thread for every SDL joystick event. */
+void sdl_joystick_event(SDL_Event *event)
+{
+        int c;
+
+        switch (event->type)
+        {
+                case SDL_JOYAXISMOTION:
+                c = joystick_slot(event->jaxis.which);
+                if ((c >= 0) && (event->jaxis.axis < JOY_AXES))
+                        input_queue_push(&joy_input, INPUT_EVENT_JOY_AXIS, c, event->jaxis.axis, event->jaxis.value, 0);
+                break;
+
+                case SDL_JOYBUTTONDOWN: case SDL_JOYBUTTONUP:
+                c = joystick_slot(event->jbutton.which);
+                if ((c >= 0) && (event->jbutton.button < JOY_BUTTONS))
+                        input_queue_push(&joy_input, INPUT_EVENT_JOY_BUTTON, c, event->jbutton.button, event->jbutton.state == SDL_PRESSED, 0);
+                break;
+
+                case SDL_JOYHATMOTION:
+                c = joystick_slot(event->jhat.which);
+                if ((c >= 0) && (event->jhat.hat < JOY_HATS))
+                        input_queue_push(&joy_input, INPUT_EVENT_JOY_HAT, c, event->jhat.hat, event->jhat.value, 0);
+                break;
+
+                case SDL_JOYDEVICEADDED:
+                joystick_open(event->jdevice.which);
+                break;
+
+                case SDL_JOYDEVICEREMOVED:
+                joystick_remove(event->jdevice.which);
+                break;
+        }
+}
+
+/* Called by the emulation thread from input_queue_drain(). */
+static void joystick_input_event(const input_event_t *ev)
+{
+        plat_joystick_t *joy;
+
+        if (ev->device >= MAX_PLAT_JOYSTICKS)
+                return;
+        joy = &plat_joystick_state[ev->device];
+
+        switch (ev->type)
+        {
+                case INPUT_EVENT_JOY_AXIS:
+                joy->a[ev->code] = ev->value;
+                break;
+
+                case INPUT_EVENT_JOY_BUTTON:
+                joy->b[ev->code] = ev->value;
+                break;
+
+                case INPUT_EVENT_JOY_HAT:
+                joy->p[ev->code] = ev->value;
+                break;
+
+                case INPUT_EVENT_JOY_DEVICE:
+                /* Plugged or unplugged, the device starts out centered. */
+                memset(joy->a, 0, sizeof(joy->a));
+                memset(joy->b, 0, sizeof(joy->b));
+                memset(joy->p, 0, sizeof(joy->p));
+                break;
+        }
+
+        joystick_dirty = 1;
+}
 
 void joystick_init(void)
 {
         int c;
-        
+
         SDL_InitSubSystem(SDL_INIT_JOYSTICK);
-        joysticks_present = SDL_NumJoysticks();
+        SDL_JoystickEventState(SDL_ENABLE);
+
+        for (c = 0; c < 16; c++)
+                hat_pov[c] = pov_angle(hat_x(c), hat_y(c));
 
+        input_queue_register(&joy_input);
+        input_queue_joystick_handler = joystick_input_event;
+
+        joysticks_present = 0;
         memset(sdl_joy, 0, sizeof(sdl_joy));
-        for (c = 0; c < joysticks_present; c++)
-        {
-                sdl_joy[c] = SDL_JoystickOpen(c);
-                
-                if (sdl_joy[c])
-                {
-                        int d;
-                        
-                        pclog("Opened Joystick %i\n", c);
-                        pclog(" Name: %s\n", SDL_JoystickName(sdl_joy[c]));
-                        pclog(" Number of Axes: %d\n", SDL_JoystickNumAxes(sdl_joy[c]));
-                        pclog(" Number of Buttons: %d\n", SDL_JoystickNumButtons(sdl_joy[c]));
-                        pclog(" Number of Hats: %d\n", SDL_JoystickNumHats(sdl_joy[c]));
-                        
-                        strncpy(plat_joystick_state[c].name, SDL_JoystickNameForIndex(c), 64);
-                        plat_joystick_state[c].nr_axes = SDL_JoystickNumAxes(sdl_joy[c]);
-                        plat_joystick_state[c].nr_buttons = SDL_JoystickNumButtons(sdl_joy[c]);
-                        plat_joystick_state[c].nr_povs = SDL_JoystickNumHats(sdl_joy[c]);
-                        
-                        for (d = 0; d < MIN(plat_joystick_state[c].nr_axes, 8); d++)
-                        {
-                                sprintf(plat_joystick_state[c].axis[d].name, "Axis %i", d);
-                                plat_joystick_state[c].axis[d].id = d;
-                        }
-                        for (d = 0; d < MIN(plat_joystick_state[c].nr_buttons, 8); d++)
-                        {
-                                sprintf(plat_joystick_state[c].button[d].name, "Button %i", d);
-                                plat_joystick_state[c].button[d].id = d;
-                        }
-                        for (d = 0; d < MIN(plat_joystick_state[c].nr_povs, 4); d++)
-                        {
-                                sprintf(plat_joystick_state[c].pov[d].name, "POV %i", d);
-                                plat_joystick_state[c].pov[d].id = d;
-                        }
-                }
-        }
+        for (c = 0; c < SDL_NumJoysticks(); c++)
+                joystick_open(c);
+
+        joystick_dirty = 1;
 }
 void joystick_close(void)
 {
         int c;
-        
-        for (c = 0; c < joysticks_present; c++)
+
+        for (c = 0; c < MAX_PLAT_JOYSTICKS; c++)
         {
                 if (sdl_joy[c])
                         SDL_JoystickClose(sdl_joy[c]);
+                sdl_joy[c] = NULL;
         }
 }
 
 static int joystick_get_axis(int joystick_nr, int mapping)
 {
         if (mapping & POV_X)
-        {
-                switch (plat_joystick_state[joystick_nr].p[mapping & 3])
-                {
-                        case SDL_HAT_LEFTUP: case SDL_HAT_LEFT: case SDL_HAT_LEFTDOWN:
-                        return -32767;
-
-                        case SDL_HAT_RIGHTUP: case SDL_HAT_RIGHT: case SDL_HAT_RIGHTDOWN:
-                        return 32767;
-
-                        default:
-                        return 0;
-                }
-        }
+                return hat_x(plat_joystick_state[joystick_nr].p[mapping & 3]);
         else if (mapping & POV_Y)
+                return hat_y(plat_joystick_state[joystick_nr].p[mapping & 3]);
+        else
+                return plat_joystick_state[joystick_nr].a[plat_joystick_state[joystick_nr].axis[mapping].id];
+}
+/* The configuration can change the joystick type or the mapping while no
+   event arrives, which has to be applied as well. */
+static int joystick_remapped(void)
+{
+        int c, changed = (joystick_type != mapped_type);
+
+        for (c = 0; c < MAX_JOYSTICKS; c++)
         {
-                switch (plat_joystick_state[joystick_nr].p[mapping & 3])
+                if ((joystick_state[c].plat_joystick_nr != mapped[c].plat_joystick_nr) ||
+                    memcmp(joystick_state[c].axis_mapping, mapped[c].axis_mapping, sizeof(mapped[c].axis_mapping)) ||
+                    memcmp(joystick_state[c].button_mapping, mapped[c].button_mapping, sizeof(mapped[c].button_mapping)) ||
+                    memcmp(joystick_state[c].pov_mapping, mapped[c].pov_mapping, sizeof(mapped[c].pov_mapping)))
                 {
-                        case SDL_HAT_LEFTUP: case SDL_HAT_UP: case SDL_HAT_RIGHTUP:
-                        return -32767;
-
-                        case SDL_HAT_LEFTDOWN: case SDL_HAT_DOWN: case SDL_HAT_RIGHTDOWN:
-                        return 32767;
-
-                        default:
-                        return 0;
+                        mapped[c].plat_joystick_nr = joystick_state[c].plat_joystick_nr;
+                        memcpy(mapped[c].axis_mapping, joystick_state[c].axis_mapping, sizeof(mapped[c].axis_mapping));
+                        memcpy(mapped[c].button_mapping, joystick_state[c].button_mapping, sizeof(mapped[c].button_mapping));
+                        memcpy(mapped[c].pov_mapping, joystick_state[c].pov_mapping, sizeof(mapped[c].pov_mapping));
+                        changed = 1;
                 }
         }
-        else
-                return plat_joystick_state[joystick_nr].a[plat_joystick_state[joystick_nr].axis[mapping].id];
+
+        mapped_type = joystick_type;
+        return changed;
 }
+
 void joystick_process(void)
 {
         int c, d;
 
-        SDL_JoystickUpdate();
-        for (c = 0; c < joysticks_present; c++)
-        {
-                int b;
-                
-                plat_joystick_state[c].a[0] = SDL_JoystickGetAxis(sdl_joy[c], 0);
-                plat_joystick_state[c].a[1] = SDL_JoystickGetAxis(sdl_joy[c], 1);
-                plat_joystick_state[c].a[2] = SDL_JoystickGetAxis(sdl_joy[c], 2);
-                plat_joystick_state[c].a[3] = SDL_JoystickGetAxis(sdl_joy[c], 3);
-                plat_joystick_state[c].a[4] = SDL_JoystickGetAxis(sdl_joy[c], 4);
-                plat_joystick_state[c].a[5] = SDL_JoystickGetAxis(sdl_joy[c], 5);
-                
-                for (b = 0; b < 16; b++)
-                        plat_joystick_state[c].b[b] = SDL_JoystickGetButton(sdl_joy[c], b);
-
-                for (b = 0; b < 4; b++)
-                        plat_joystick_state[c].p[b] = SDL_JoystickGetHat(sdl_joy[c], b);
-//                pclog("joystick %i - x=%i y=%i b[0]=%i b[1]=%i  %i\n", c, joystick_state[c].x, joystick_state[c].y, joystick_state[c].b[0], joystick_state[c].b[1], joysticks_present);
-        }
-        
+        if (joystick_remapped())
+                joystick_dirty = 1;
+
+        /* Nothing to map until an event or the configuration changed something. */
+        if (!joystick_dirty)
+                return;
+        joystick_dirty = 0;
+
         for (c = 0; c < joystick_get_max_joysticks(joystick_type); c++)
         {
                 if (joystick_state[c].plat_joystick_nr)
                 {
                         int joystick_nr = joystick_state[c].plat_joystick_nr - 1;
-                        
+
                         for (d = 0; d < joystick_get_axis_count(joystick_type); d++)
                                 joystick_state[c].axis[d] = joystick_get_axis(joystick_nr, joystick_state[c].axis_mapping[d]);
                         for (d = 0; d < joystick_get_button_count(joystick_type); d++)
                                 joystick_state[c].button[d] = plat_joystick_state[joystick_nr].b[joystick_state[c].button_mapping[d]];
                         for (d = 0; d < joystick_get_pov_count(joystick_type); d++)
                         {
-                                int x, y;
-                                double angle, magnitude;
-
-                                x = joystick_get_axis(joystick_nr, joystick_state[c].pov_mapping[d][0]);
-                                y = joystick_get_axis(joystick_nr, joystick_state[c].pov_mapping[d][1]);
-                                
-                                angle = (atan2((double)y, (double)x) * 360.0) / (2*M_PI);
-                                magnitude = sqrt((double)x*(double)x + (double)y*(double)y);
-                                
-                                if (magnitude < 16384)
-                                        joystick_state[c].pov[d] = -1;
+                                int x_map = joystick_state[c].pov_mapping[d][0];
+                                int y_map = joystick_state[c].pov_mapping[d][1];
+
+                                /* Both halves of one hat, the common case, come from the table. */
+                                if ((x_map & POV_X) && (y_map & POV_Y) && ((x_map & 3) == (y_map & 3)))
+                                        joystick_state[c].pov[d] = hat_pov[plat_joystick_state[joystick_nr].p[x_map & 3] & 15];
                                 else
-                                        joystick_state[c].pov[d] = ((int)angle + 90 + 360) % 360;
+                                        joystick_state[c].pov[d] = pov_angle(joystick_get_axis(joystick_nr, x_map),
+                                                                             joystick_get_axis(joystick_nr, y_map));
                         }
                 }
                 else
@@ -73,11 +73,54 @@
 #include <86box/thread.h>
 #include <86box/video.h>
 #include <86box/vid_svga.h>
+#include <86box/harness.h>
 
 #include <minitrace/minitrace.h>
 
+/*
+ * The lookup tables below are filled in at compile time, so they cost no
+ * startup work and the const ones live in read-only pages shared by every
+ * running instance. VIDEO_TBLn(f, n) expands to f(n) ... f(n + n - 1).
+ * The conversions give the same results as the calc_*() functions.
+ */
+#define VIDEO_TBL4(f, n)     f(n), f((n) + 1), f((n) + 2), f((n) + 3)
+#define VIDEO_TBL16(f, n)    VIDEO_TBL4(f, n), VIDEO_TBL4(f, (n) + 4), VIDEO_TBL4(f, (n) + 8), VIDEO_TBL4(f, (n) + 12)
+#define VIDEO_TBL64(f, n)    VIDEO_TBL16(f, n), VIDEO_TBL16(f, (n) + 16), VIDEO_TBL16(f, (n) + 32), VIDEO_TBL16(f, (n) + 48)
+#define VIDEO_TBL256(f, n)   VIDEO_TBL64(f, n), VIDEO_TBL64(f, (n) + 64), VIDEO_TBL64(f, (n) + 128), VIDEO_TBL64(f, (n) + 192)
+#define VIDEO_TBL1024(f, n)  VIDEO_TBL256(f, n), VIDEO_TBL256(f, (n) + 256), VIDEO_TBL256(f, (n) + 512), VIDEO_TBL256(f, (n) + 768)
+#define VIDEO_TBL4096(f, n)  VIDEO_TBL1024(f, n), VIDEO_TBL1024(f, (n) + 1024), VIDEO_TBL1024(f, (n) + 2048), VIDEO_TBL1024(f, (n) + 3072)
+#define VIDEO_TBL16384(f, n) VIDEO_TBL4096(f, n), VIDEO_TBL4096(f, (n) + 4096), VIDEO_TBL4096(f, (n) + 8192), VIDEO_TBL4096(f, (n) + 12288)
+#define VIDEO_TBL65536(f, n) VIDEO_TBL16384(f, n), VIDEO_TBL16384(f, (n) + 16384), VIDEO_TBL16384(f, (n) + 32768), VIDEO_TBL16384(f, (n) + 49152)
+
+#define VIDEO_6TO8(c)   (((((c) == 64) ? 63 : ((c) & 0x3f)) * 255) / 63)
+#define VIDEO_8TOGS(c)  ((c) | ((c) << 16) | ((c) << 24))
+#define VIDEO_8TO32(c)  (((((c) & 3) * 255) / 3) | (((((c) >> 2) & 7) * 255 / 7) << 8) | (((((c) >> 5) & 7) * 255 / 7) << 16))
+#define VIDEO_15TO32(c) (((((c) & 31) * 255) / 31) | (((((c) >> 5) & 31) * 255 / 31) << 8) | (((((c) >> 10) & 31) * 255 / 31) << 16))
+#define VIDEO_16TO32(c) (((((c) & 31) * 255) / 31) | (((((c) >> 5) & 63) * 255 / 63) << 8) | (((((c) >> 11) & 31) * 255 / 31) << 16))
+
+#define CGA_2(c) ((((c) >> 3) & 1) | ((((c) >> 2) & 1) << 8) | ((((c) >> 1) & 1) << 16) | (((c) & 1) << 24))
+
+#define CGAPAL_64_G(c) (((((c) & 2) ? 2 : 0) | (((c) & 0x10) ? 1 : 0)) * 21)
+#define CGAPAL_64(c)                                          \
+    {                                                         \
+        (((((c) & 4) ? 2 : 0) | (((c) & 0x10) ? 1 : 0)) * 21), \
+        ((((c) & 0x17) == 6) ? (CGAPAL_64_G(c) >> 1) : CGAPAL_64_G(c)), \
+        (((((c) & 1) ? 2 : 0) | (((c) & 0x10) ? 1 : 0)) * 21)  \
+    }
+#define CGAPAL_128(c)                                         \
+    {                                                         \
+        (((((c) & 4) ? 2 : 0) | (((c) & 0x20) ? 1 : 0)) * 21), \
+        (((((c) & 2) ? 2 : 0) | (((c) & 0x10) ? 1 : 0)) * 21), \
+        (((((c) & 1) ? 2 : 0) | (((c) & 0x08) ? 1 : 0)) * 21)  \
+    }
+
 volatile int screenshots = 0;
-uint8_t      edatlookup[4][4];
+uint8_t      edatlookup[4][4] = {
+    { 0x00, 0x02, 0x20, 0x22 },
+    { 0x01, 0x03, 0x21, 0x23 },
+    { 0x10, 0x12, 0x30, 0x32 },
+    { 0x11, 0x13, 0x31, 0x33 }
+};
 uint8_t      fontdat[2048][8];            /* IBM CGA font */
 uint8_t      fontdatm[2048][16];          /* IBM MDA font */
 uint8_t      fontdatw[512][32];           /* Wyse700 font */
@@ -91,11 +134,11 @@ int          fullchange           = 0;
 int          video_grayscale      = 0;
 int          video_graytype       = 0;
 int          monitor_index_global = 0;
-uint32_t    *video_6to8           = NULL,
-         *video_8togs             = NULL,
-         *video_8to32             = NULL,
-         *video_15to32            = NULL,
-         *video_16to32            = NULL;
+const uint32_t video_6to8[256]     = { VIDEO_TBL256(VIDEO_6TO8, 0) };
+const uint32_t video_8togs[256]    = { VIDEO_TBL256(VIDEO_8TOGS, 0) };
+const uint32_t video_8to32[256]    = { VIDEO_TBL256(VIDEO_8TO32, 0) };
+const uint32_t video_15to32[65536] = { VIDEO_TBL65536(VIDEO_15TO32, 0) }; /* Bit 15 is ignored. */
+const uint32_t video_16to32[65536] = { VIDEO_TBL65536(VIDEO_16TO32, 0) };
 monitor_t          monitors[MONITORS_NUM];
 monitor_settings_t monitor_settings[MONITORS_NUM];
 atomic_bool        doresize_monitors[MONITORS_NUM];
@@ -108,6 +151,20 @@ unsigned char      switchres_interlace = 1;
 int                switchres_switch = 0;
 //end psakhis
 
+/* Mode switch latency, from the switchres call to the first frame presented
+   in the new mode, kept per mode so video_close() can report p50/p99. */
+#define SWITCHRES_STATS_MODES   16
+#define SWITCHRES_STATS_SAMPLES 256
+
+static struct {
+    int           width, height;
+    unsigned char interlace;
+    int           count;
+    uint32_t      us[SWITCHRES_STATS_SAMPLES];
+} switchres_stats[SWITCHRES_STATS_MODES];
+static int      switchres_stats_pending = -1;
+static uint32_t switchres_stats_start;
+
 #ifdef _WIN32
 void *__cdecl (*video_copy)(void *_Dst, const void *_Src, size_t _Size) = memcpy;
 #else
@@ -135,6 +192,9 @@ PALETTE		cgapal = {
     {0,0,0},   {0,42,42},   {42,0,0},   {42,42,42},
     {0,0,0},   {0,63,63},   {63,0,0},   {63,63,63},
     {0,0,0},   {0,63,63},   {63,0,0},   {63,63,63},
+
+    VIDEO_TBL64(CGAPAL_64, 0),
+    VIDEO_TBL64(CGAPAL_128, 0)
 };
 PALETTE		cgapal_mono[6] = {
     {	/* 0 - green, 4-color-optimized contrast. */
@@ -242,22 +302,55 @@ const uint32_t shade[5][256] =
 	}
 };
 
+/* Bits of blit_data_t.state. */
+#define BLIT_BUSY    0x01 /* A frame was handed to the blit thread. */
+#define BLIT_BUFFER  0x02 /* The renderer still reads the target buffer. */
+#define BLIT_QUIT    0x04 /* The blit thread is to exit. */
+#define BLIT_WAITERS 0x08 /* Someone sleeps on the state word. */
+#define BLIT_FREED   0x10 /* A frame queue slot was handed back. */
+
+/* Spins before sleeping on the state word, adapted per waiter. */
+#define BLIT_SPIN_MIN 16
+#define BLIT_SPIN_MAX 4096
+
+/* States of a frame queue slot. */
+#define FRAME_FREE    0
+#define FRAME_WRITING 1 /* Being filled by the emulation thread. */
+#define FRAME_READY   2
+#define FRAME_READING 3 /* Being presented by the blit thread. */
+
+typedef struct blit_frame_t {
+    bitmap_t  *buffer;
+    int        x, y, w, h;
+    uint32_t   seq;
+    atomic_int state;
+} blit_frame_t;
+
 typedef struct blit_data_struct {
     int x, y, w, h;
-    int busy;
-    int buffer_in_use;
-    int thread_run;
     int monitor_index;
 
+    /* Frame queue, frames = 0 when the renderer reads the target buffer directly. */
+    int           frames;
+    int           latest;  /* Overwrite the oldest queued frame instead of waiting. */
+    uint32_t      seq;     /* Emulation thread, last frame queued. */
+    blit_frame_t *reading; /* Blit thread, the slot being presented. */
+    blit_frame_t  frame[VIDEO_FRAME_QUEUE_MAX];
+
+    /* The whole handshake between the emulation and blit threads. */
+    atomic_int state;
+    int        spin_blit;   /* Emulation thread, waiting for BLIT_BUSY to clear. */
+    int        spin_buffer; /* Emulation thread, waiting for BLIT_BUFFER to clear. */
+    int        spin_frame;  /* Blit thread, waiting for a frame. */
+
     thread_t *blit_thread;
-    event_t  *wake_blit_thread;
-    event_t  *blit_complete;
-    event_t  *buffer_not_in_use;
 } blit_data_t;
 
-static uint32_t cga_2_table[16];
+static const uint32_t cga_2_table[16] = { VIDEO_TBL16(CGA_2, 0) };
 
 static void (*blit_func)(int x, int y, int w, int h, int monitor_index);
+static int (*blit_drop_func)(int monitor_index);
+static int video_first_frame = 1;
 
 #ifdef ENABLE_VIDEO_LOG
 int video_do_log = ENABLE_VIDEO_LOG;
@@ -277,19 +370,262 @@ video_log(const char *fmt, ...)
 #    define video_log(fmt, ...)
 #endif
 
+/*
+ * The per-pixel kernels in video_kernels.h are built for the baseline
+ * instruction set and, with GCC on x86, for x86-64-v2 (SSE4.2) and
+ * x86-64-v3 (AVX2) too. video_kernels_init() picks the best set the host
+ * CPU has, so one binary runs on every host and still gets wide vectors.
+ */
+static inline uint32_t
+video_kernel_gray(uint32_t c, int type)
+{
+    uint32_t r = (c >> 16) & 0xff;
+    uint32_t g = (c >> 8) & 0xff;
+    uint32_t b = c & 0xff;
+
+    if (type == 0)
+        return ((76 * r) + (150 * g) + (29 * b)) / 255;
+    else if (type == 1)
+        return ((54 * r) + (183 * g) + (18 * b)) / 255;
+
+    return (r + g + b) / 3;
+}
+
+#define VIDEO_KERNEL(name) video_##name##_base
+#include "video_kernels.h"
+#undef VIDEO_KERNEL
+
+#if defined(__GNUC__) && !defined(__clang__) && (defined(__x86_64__) || defined(__i386__))
+#    define VIDEO_KERNELS_X86
+
+#    pragma GCC push_options
+#    pragma GCC target("sse4.2,popcnt")
+#    define VIDEO_KERNEL(name) video_##name##_v2
+#    include "video_kernels.h"
+#    undef VIDEO_KERNEL
+#    pragma GCC pop_options
+
+#    pragma GCC push_options
+#    pragma GCC target("avx2,bmi,bmi2,fma,f16c,lzcnt,movbe")
+#    define VIDEO_KERNEL(name) video_##name##_v3
+#    include "video_kernels.h"
+#    undef VIDEO_KERNEL
+#    pragma GCC pop_options
+#endif
+
+void (*video_fill)(uint32_t *p, uint32_t col, int n) = video_fill_base;
+
+static void (*video_transform)(uint32_t *__restrict dst, const uint32_t *__restrict src, int n) = video_transform_base;
+static void (*video_rgb24)(uint8_t *__restrict dst, const uint32_t *__restrict src, int n)      = video_rgb24_base;
+
+static void
+video_kernels_init(void)
+{
+    const char *name = "baseline";
+
+#ifdef VIDEO_KERNELS_X86
+    __builtin_cpu_init();
+
+    /* Every feature in the target options above must be checked, the
+       compiler is free to use any of them anywhere in those kernels. */
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("bmi") && __builtin_cpu_supports("bmi2")
+        && __builtin_cpu_supports("fma") && __builtin_cpu_supports("f16c") && __builtin_cpu_supports("lzcnt")
+        && __builtin_cpu_supports("movbe")) {
+        video_fill      = video_fill_v3;
+        video_transform = video_transform_v3;
+        video_rgb24     = video_rgb24_v3;
+        name            = "x86-64-v3 (AVX2)";
+    } else if (__builtin_cpu_supports("sse4.2") && __builtin_cpu_supports("popcnt")) {
+        video_fill      = video_fill_v2;
+        video_transform = video_transform_v2;
+        video_rgb24     = video_rgb24_v2;
+        name            = "x86-64-v2 (SSE4.2)";
+    }
+#endif
+
+    pclog("Video: using %s pixel kernels\n", name);
+}
+
 void
 video_setblit(void (*blit)(int, int, int, int, int))
 {
     blit_func = blit;
 }
 
+/* Lets the renderer tell ahead of time that it will drop the next frame. */
+void
+video_setblitdrop(int (*drop)(int))
+{
+    blit_drop_func = drop;
+}
+
+#if defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
+#    define blit_pause() __builtin_ia32_pause()
+#else
+#    define blit_pause()
+#endif
+
+/* Set and clear bits of the state word, waking the sleepers if there are any.
+   Returns the previous state. */
+static int
+video_blit_update(blit_data_t *data, int set, int clear)
+{
+    int old = atomic_load_explicit(&data->state, memory_order_relaxed);
+
+    while (!atomic_compare_exchange_weak_explicit(&data->state, &old, (old | set) & ~(clear | BLIT_WAITERS),
+                                                  memory_order_acq_rel, memory_order_relaxed))
+        ;
+
+    if (old & BLIT_WAITERS)
+        plat_wake_all(&data->state);
+
+    return old;
+}
+
+/* Wait until any bit of mask is in the state word (set = 1) or none is
+   (set = 0). Spins first: when the other side usually answers within the spin
+   the spin grows, when it sleeps anyway the spin shrinks. Returns the state. */
+static int
+video_blit_wait(blit_data_t *data, int mask, int set, int *spin)
+{
+    int s;
+    int i = 0;
+
+    while (1) {
+        s = atomic_load_explicit(&data->state, memory_order_acquire);
+        if (!(s & mask) == !set)
+            break;
+
+        if (i < *spin) {
+            blit_pause();
+            i++;
+            continue;
+        }
+
+        /* Let the waking side know it has to wake us, then sleep on the word as we saw it. */
+        if (!(s & BLIT_WAITERS) && !atomic_compare_exchange_weak_explicit(&data->state, &s, s | BLIT_WAITERS,
+                                                                          memory_order_relaxed, memory_order_relaxed))
+            continue;
+
+        plat_wait_on(&data->state, s | BLIT_WAITERS);
+        i++;
+    }
+
+    if (i == 0)
+        return s;
+
+    if (i <= *spin) {
+        if (*spin < BLIT_SPIN_MAX)
+            *spin <<= 1;
+    } else if (*spin > BLIT_SPIN_MIN)
+        *spin >>= 1;
+
+    return s;
+}
+
+/* Hand a presented slot back to the emulation thread, once. */
+static void
+video_frame_done(blit_data_t *data)
+{
+    int state = FRAME_READING;
+
+    if ((data->reading != NULL) && atomic_compare_exchange_strong(&data->reading->state, &state, FRAME_FREE))
+        video_blit_update(data, BLIT_FREED, 0);
+}
+
 void
 video_blit_complete_monitor(int monitor_index)
 {
-    blit_data_t *blit_data_ptr   = monitors[monitor_index].mon_blit_data_ptr;
-    blit_data_ptr->buffer_in_use = 0;
+    blit_data_t *blit_data_ptr = monitors[monitor_index].mon_blit_data_ptr;
 
-    thread_set_event(blit_data_ptr->buffer_not_in_use);
+    if (blit_data_ptr->frames)
+        video_frame_done(blit_data_ptr);
+    else
+        video_blit_update(blit_data_ptr, 0, BLIT_BUFFER);
+}
+
+/* Find a slot for the next frame. A free slot if there is one; in latest mode
+   otherwise the oldest queued frame, which is then lost. In run-ahead mode the
+   emulation thread only waits here when all slots are queued or presented. */
+static blit_frame_t *
+video_frame_claim(blit_data_t *data)
+{
+    blit_frame_t *f, *oldest;
+    int           state;
+    int           armed = 0;
+
+    while (1) {
+        oldest = NULL;
+
+        for (int i = 0; i < data->frames; i++) {
+            f     = &data->frame[i];
+            state = atomic_load_explicit(&f->state, memory_order_acquire);
+
+            if ((state == FRAME_FREE) && atomic_compare_exchange_strong(&f->state, &state, FRAME_WRITING))
+                return f;
+
+            if ((state == FRAME_READY) && ((oldest == NULL) || ((int32_t) (f->seq - oldest->seq) < 0)))
+                oldest = f;
+        }
+
+        if (data->latest) {
+            state = FRAME_READY;
+            if ((oldest != NULL) && atomic_compare_exchange_strong(&oldest->state, &state, FRAME_WRITING))
+                return oldest;
+            continue;
+        }
+
+        /* Clear the flag before looking again, so a slot freed in between is not missed. */
+        if (!armed) {
+            video_blit_update(data, 0, BLIT_FREED);
+            armed = 1;
+            continue;
+        }
+
+        if (video_blit_wait(data, BLIT_FREED | BLIT_QUIT, 1, &data->spin_buffer) & BLIT_QUIT)
+            return NULL;
+        armed = 0;
+    }
+}
+
+/* Take the next queued frame for presenting: the oldest one in run-ahead mode,
+   the newest one in latest mode, which drops the ones before it. */
+static blit_frame_t *
+video_frame_next(blit_data_t *data)
+{
+    blit_frame_t *f, *pick;
+    int           state;
+
+    while (1) {
+        pick = NULL;
+
+        for (int i = 0; i < data->frames; i++) {
+            f = &data->frame[i];
+            if (atomic_load_explicit(&f->state, memory_order_acquire) != FRAME_READY)
+                continue;
+
+            if ((pick == NULL) || (data->latest ? ((int32_t) (f->seq - pick->seq) > 0) : ((int32_t) (f->seq - pick->seq) < 0)))
+                pick = f;
+        }
+
+        if (pick == NULL)
+            return NULL;
+
+        state = FRAME_READY;
+        if (!atomic_compare_exchange_strong(&pick->state, &state, FRAME_READING))
+            continue;
+
+        if (data->latest) {
+            for (int i = 0; i < data->frames; i++) {
+                f     = &data->frame[i];
+                state = FRAME_READY;
+                if ((f != pick) && ((int32_t) (f->seq - pick->seq) < 0) && atomic_compare_exchange_strong(&f->state, &state, FRAME_FREE))
+                    video_blit_update(data, BLIT_FREED, 0);
+            }
+        }
+
+        return pick;
+    }
 }
 
 void
@@ -297,9 +633,7 @@ video_wait_for_blit_monitor(int monitor_index)
 {
     blit_data_t *blit_data_ptr = monitors[monitor_index].mon_blit_data_ptr;
 
-    while (blit_data_ptr->busy)
-        thread_wait_event(blit_data_ptr->blit_complete, -1);
-    thread_reset_event(blit_data_ptr->blit_complete);
+    video_blit_wait(blit_data_ptr, BLIT_BUSY, 0, &blit_data_ptr->spin_blit);
 }
 
 void
@@ -307,9 +641,7 @@ video_wait_for_buffer_monitor(int monitor_index)
 {
     blit_data_t *blit_data_ptr = monitors[monitor_index].mon_blit_data_ptr;
 
-    while (blit_data_ptr->buffer_in_use)
-        thread_wait_event(blit_data_ptr->buffer_not_in_use, -1);
-    thread_reset_event(blit_data_ptr->buffer_not_in_use);
+    video_blit_wait(blit_data_ptr, BLIT_BUFFER, 0, &blit_data_ptr->spin_buffer);
 }
 
 static png_structp png_ptr[MONITORS_NUM];
@@ -318,10 +650,9 @@ static png_infop   info_ptr[MONITORS_NUM];
 static void
 video_take_screenshot_monitor(const char *fn, uint32_t *buf, int start_x, int start_y, int row_len, int monitor_index)
 {
-    int          i, x, y;
+    int          i, y;
     png_bytep   *b_rgb         = NULL;
     FILE        *fp            = NULL;
-    uint32_t     temp          = 0x00000000;
     blit_data_t *blit_data_ptr = monitors[monitor_index].mon_blit_data_ptr;
 
     /* create file */
@@ -362,16 +693,10 @@ video_take_screenshot_monitor(const char *fn, uint32_t *buf, int start_x, int st
 
     for (y = 0; y < blit_data_ptr->h; ++y) {
         b_rgb[y] = (png_byte *) malloc(png_get_rowbytes(png_ptr[monitor_index], info_ptr[monitor_index]));
-        for (x = 0; x < blit_data_ptr->w; ++x) {
-            if (buf == NULL)
-                memset(&(b_rgb[y][x * 3]), 0x00, 3);
-            else {
-                temp                  = buf[((start_y + y) * row_len) + start_x + x];
-                b_rgb[y][x * 3]       = (temp >> 16) & 0xff;
-                b_rgb[y][(x * 3) + 1] = (temp >> 8) & 0xff;
-                b_rgb[y][(x * 3) + 2] = temp & 0xff;
-            }
-        }
+        if (buf == NULL)
+            memset(b_rgb[y], 0x00, blit_data_ptr->w * 3);
+        else
+            video_rgb24(b_rgb[y], &buf[((start_y + y) * row_len) + start_x], blit_data_ptr->w);
     }
 
     png_write_info(png_ptr[monitor_index], info_ptr[monitor_index]);
@@ -433,42 +758,144 @@ void *
 video_transform_copy(void *__restrict _Dst, const void *__restrict _Src, size_t _Size)
 #endif
 {
-    int       i;
-    uint32_t *dest_ex = (uint32_t *) _Dst;
-    uint32_t *src_ex  = (uint32_t *) _Src;
+    if ((_Dst != NULL) && (_Src != NULL))
+        video_transform((uint32_t *) _Dst, (const uint32_t *) _Src, _Size / sizeof(uint32_t));
 
-    _Size /= sizeof(uint32_t);
+    return _Dst;
+}
 
-    if ((dest_ex != NULL) && (src_ex != NULL)) {
-        for (i = 0; i < _Size; i++) {
-            *dest_ex = video_color_transform(*src_ex);
-            dest_ex++;
-            src_ex++;
+/* Present queued frames until told to quit. */
+static void
+blit_thread_queue(blit_data_t *data)
+{
+    while (!(video_blit_wait(data, BLIT_BUSY | BLIT_QUIT, 1, &data->spin_frame) & BLIT_QUIT)) {
+        /* Clear the flag before looking, so a frame queued in between is not missed. */
+        video_blit_update(data, 0, BLIT_BUSY);
+
+        while ((data->reading = video_frame_next(data)) != NULL) {
+            MTR_BEGIN("video", "blit_thread");
+
+            monitors[data->monitor_index].mon_blit_buffer = data->reading->buffer;
+            if (blit_func)
+                blit_func(data->reading->x, data->reading->y, data->reading->w, data->reading->h, data->monitor_index);
+
+            /* In case the renderer did not hand it back itself. */
+            video_frame_done(data);
+
+            MTR_END("video", "blit_thread");
         }
     }
-
-    return _Dst;
 }
 
+/* Present the target buffer itself, one frame at a time. */
 static void
-blit_thread(void *param)
+blit_thread_direct(blit_data_t *data)
 {
-    blit_data_t *data = param;
-    while (data->thread_run) {
-        thread_wait_event(data->wake_blit_thread, -1);
-        thread_reset_event(data->wake_blit_thread);
+    while (!(video_blit_wait(data, BLIT_BUSY | BLIT_QUIT, 1, &data->spin_frame) & BLIT_QUIT)) {
         MTR_BEGIN("video", "blit_thread");
 
         if (blit_func)
             blit_func(data->x, data->y, data->w, data->h, data->monitor_index);
 
-        data->busy = 0;
-
         MTR_END("video", "blit_thread");
-        thread_set_event(data->blit_complete);
+        video_blit_update(data, 0, BLIT_BUSY);
     }
 }
 
+static void
+blit_thread(void *param)
+{
+    blit_data_t *data = param;
+
+    plat_thread_tune(PLAT_THREAD_BLIT);
+
+    if (data->frames)
+        blit_thread_queue(data);
+    else
+        blit_thread_direct(data);
+
+    plat_thread_done(PLAT_THREAD_BLIT);
+}
+
+/* Hand back target buffer rows that stayed unused for this long, in ms. */
+#define TRIM_HYSTERESIS 10000
+#define TRIM_PAGE_SIZE  4096
+
+/* The target buffer covers the largest mode any card can produce, but only the
+   rows of the current mode (plus overscan) are touched. Pages fault in as a mode
+   needs them; once a smaller mode has been in use for a while, give back the
+   rows below it. Runs on the emulation thread, the blit thread never reads past
+   the current frame. */
+static void
+video_trim_bitmap(bitmap_t *b, int from, int to)
+{
+    uintptr_t start = (uintptr_t) b->line[from];
+    uintptr_t end   = (uintptr_t) &(b->dat[(size_t) to * b->w]);
+
+    start = (start + TRIM_PAGE_SIZE - 1) & ~((uintptr_t) TRIM_PAGE_SIZE - 1);
+    end &= ~((uintptr_t) TRIM_PAGE_SIZE - 1);
+
+    if (end > start)
+        plat_mem_discard((void *) start, end - start);
+}
+
+static void
+video_trim_monitor(int monitor_index, int rows)
+{
+    monitor_t *m   = &monitors[monitor_index];
+    bitmap_t  *b   = m->target_buffer;
+    uint32_t   now = plat_get_ticks();
+
+    if (rows > b->h)
+        rows = b->h;
+
+    if (rows >= m->mon_trim_rows) {
+        m->mon_trim_rows = rows;
+        m->mon_trim_time = 0;
+        return;
+    }
+
+    if (!m->mon_trim_time) {
+        m->mon_trim_time = now | 1;
+        return;
+    }
+
+    if ((now - m->mon_trim_time) < TRIM_HYSTERESIS)
+        return;
+
+    video_trim_bitmap(b, rows, m->mon_trim_rows);
+
+    /* The frame queue slots only ever hold rows of the current mode as well. */
+    for (int i = 0; i < m->mon_blit_data_ptr->frames; i++)
+        video_trim_bitmap(m->mon_blit_data_ptr->frame[i].buffer, rows, m->mon_trim_rows);
+
+    m->mon_trim_rows = rows;
+    m->mon_trim_time = 0;
+}
+
+/* Copy the frame out of the target buffer into a queue slot, so the emulation
+   thread can draw the next one without waiting for the renderer. */
+static void
+video_frame_push(blit_data_t *data, bitmap_t *src, int x, int y, int w, int h)
+{
+    blit_frame_t *f = video_frame_claim(data);
+
+    if (f == NULL)
+        return;
+
+    for (int row = 0; row < h; row++)
+        memcpy(&f->buffer->line[y + row][x], &src->line[y + row][x], w * sizeof(uint32_t));
+
+    f->x   = x;
+    f->y   = y;
+    f->w   = w;
+    f->h   = h;
+    f->seq = ++data->seq;
+    atomic_store_explicit(&f->state, FRAME_READY, memory_order_release);
+
+    video_blit_update(data, BLIT_BUSY, 0);
+}
+
 void
 video_blit_memtoscreen_monitor(int x, int y, int w, int h, int monitor_index)
 {
@@ -477,19 +904,67 @@ video_blit_memtoscreen_monitor(int x, int y, int w, int h, int monitor_index)
     if ((w <= 0) || (h <= 0))
         return;
 
-    video_wait_for_blit_monitor(monitor_index);
+    if (video_first_frame) {
+        video_first_frame = 0;
+        pc_startup_stage("first frame");
+    }
+
+    if (!monitors[monitor_index].mon_blit_data_ptr->frames)
+        video_wait_for_blit_monitor(monitor_index);
+
+    if (harness_active && (monitor_index == 0))
+        harness_frame(monitors[0].target_buffer, x, y, w, h);
 
-    monitors[monitor_index].mon_blit_data_ptr->busy          = 1;
-    monitors[monitor_index].mon_blit_data_ptr->buffer_in_use = 1;
-    monitors[monitor_index].mon_blit_data_ptr->x             = x;
-    monitors[monitor_index].mon_blit_data_ptr->y             = y;
-    monitors[monitor_index].mon_blit_data_ptr->w             = w;
-    monitors[monitor_index].mon_blit_data_ptr->h             = h;
+    video_trim_monitor(monitor_index, MAX(y + h, monitors[monitor_index].mon_ysize + monitors[monitor_index].mon_overscan_y));
+
+    if (monitors[monitor_index].mon_blit_data_ptr->frames) {
+        video_frame_push(monitors[monitor_index].mon_blit_data_ptr, monitors[monitor_index].target_buffer, x, y, w, h);
+        MTR_END("video", "video_blit_memtoscreen");
+        return;
+    }
 
-    thread_set_event(monitors[monitor_index].mon_blit_data_ptr->wake_blit_thread);
+    monitors[monitor_index].mon_blit_data_ptr->x = x;
+    monitors[monitor_index].mon_blit_data_ptr->y = y;
+    monitors[monitor_index].mon_blit_data_ptr->w = w;
+    monitors[monitor_index].mon_blit_data_ptr->h = h;
+
+    /* Publishes the coordinates above together with the frame. */
+    video_blit_update(monitors[monitor_index].mon_blit_data_ptr, BLIT_BUSY | BLIT_BUFFER, 0);
     MTR_END("video", "video_blit_memtoscreen");
 }
 
+/* In turbo mode only let a frame through every 1000 / video_fps ms of host time. */
+static int
+video_turbo_skip(int monitor_index)
+{
+    static uint32_t last[MONITORS_NUM];
+    uint32_t        now = plat_get_ticks();
+
+    if ((now - last[monitor_index]) < (1000 / MAX(video_fps, 1)))
+        return 1;
+
+    last[monitor_index] = now;
+    return 0;
+}
+
+/*
+ * Called by the video cards when they start drawing a frame. Returns 1 if
+ * the frame would not be presented anyway, in which case the card keeps
+ * its timing going but need not render any lines nor blit the frame.
+ * Frames are always rendered while they are hashed or a screenshot is due.
+ */
+int
+video_frame_skip(int monitor_index)
+{
+    if (harness_active || monitors[monitor_index].mon_screenshots)
+        return 0;
+
+    if (speed_turbo && video_turbo_skip(monitor_index))
+        return 1;
+
+    return blit_drop_func && blit_drop_func(monitor_index);
+}
+
 uint8_t
 pixels8(uint32_t *pixels)
 {
@@ -564,9 +1039,6 @@ cgapal_rebuild_monitor(int monitor_index)
     int       cga_palette_monitor = 0;
 
     /* We cannot do this (yet) if we have not been enabled yet. */
-    if (video_6to8 == NULL)
-        return;
-
     if (monitors[monitor_index].target_buffer == NULL || monitors[monitor_index].mon_cga_palette == NULL)
         return;
 
@@ -837,17 +1309,27 @@ video_monitor_init(int index)
     monitors[index].mon_bpp                              = 8;
     monitors[index].mon_changeframecount                 = 2;
     monitors[index].target_buffer                        = create_bitmap(2048, 2048);
+    monitors[index].mon_trim_rows                        = 2048;
     monitors[index].mon_blit_data_ptr                    = calloc(1, sizeof(blit_data_t));
-    monitors[index].mon_blit_data_ptr->wake_blit_thread  = thread_create_event();
-    monitors[index].mon_blit_data_ptr->blit_complete     = thread_create_event();
-    monitors[index].mon_blit_data_ptr->buffer_not_in_use = thread_create_event();
-    monitors[index].mon_blit_data_ptr->thread_run        = 1;
+    monitors[index].mon_blit_data_ptr->spin_blit         = BLIT_SPIN_MIN;
+    monitors[index].mon_blit_data_ptr->spin_buffer       = BLIT_SPIN_MIN;
+    monitors[index].mon_blit_data_ptr->spin_frame        = BLIT_SPIN_MIN;
     monitors[index].mon_blit_data_ptr->monitor_index     = index;
+    monitors[index].mon_blit_buffer                      = monitors[index].target_buffer;
+    if (video_frame_queue >= 2) {
+        monitors[index].mon_blit_data_ptr->frames = MIN(video_frame_queue, VIDEO_FRAME_QUEUE_MAX);
+        monitors[index].mon_blit_data_ptr->latest = !!video_frame_latest;
+        for (int i = 0; i < monitors[index].mon_blit_data_ptr->frames; i++) {
+            monitors[index].mon_blit_data_ptr->frame[i].buffer = create_bitmap(2048, 2048);
+            atomic_init(&monitors[index].mon_blit_data_ptr->frame[i].state, FRAME_FREE);
+        }
+    }
     monitors[index].mon_pal_lookup                       = calloc(sizeof(uint32_t), 256);
     monitors[index].mon_cga_palette                      = calloc(1, sizeof(int));
     monitors[index].mon_force_resize                     = 1;
     monitors[index].mon_vid_type                         = VIDEO_FLAG_TYPE_NONE;
     atomic_init(&doresize_monitors[index], 0);
+    atomic_init(&monitors[index].mon_blit_data_ptr->state, 0);
     atomic_init(&monitors[index].mon_screenshots, 0);
     if (index >= 1)
         ui_init_monitor(index);
@@ -868,14 +1350,12 @@ video_monitor_close(int monitor_index)
     if (monitors[monitor_index].target_buffer == NULL) {
         return;
     }
-    monitors[monitor_index].mon_blit_data_ptr->thread_run = 0;
-    thread_set_event(monitors[monitor_index].mon_blit_data_ptr->wake_blit_thread);
+    video_blit_update(monitors[monitor_index].mon_blit_data_ptr, BLIT_QUIT, 0);
     thread_wait(monitors[monitor_index].mon_blit_data_ptr->blit_thread);
     if (monitor_index >= 1)
         ui_deinit_monitor(monitor_index);
-    thread_destroy_event(monitors[monitor_index].mon_blit_data_ptr->buffer_not_in_use);
-    thread_destroy_event(monitors[monitor_index].mon_blit_data_ptr->blit_complete);
-    thread_destroy_event(monitors[monitor_index].mon_blit_data_ptr->wake_blit_thread);
+    for (int i = 0; i < monitors[monitor_index].mon_blit_data_ptr->frames; i++)
+        destroy_bitmap(monitors[monitor_index].mon_blit_data_ptr->frame[i].buffer);
     free(monitors[monitor_index].mon_blit_data_ptr);
     if (!monitors[monitor_index].mon_pal_lookup_static)
         free(monitors[monitor_index].mon_pal_lookup);
@@ -889,74 +1369,81 @@ video_monitor_close(int monitor_index)
 void
 video_init(void)
 {
-    int     c, d;
-    uint8_t total[2] = { 0, 1 };
+    video_kernels_init();
 
-    for (c = 0; c < 16; c++) {
-        cga_2_table[c] = (total[(c >> 3) & 1] << 0) | (total[(c >> 2) & 1] << 8) | (total[(c >> 1) & 1] << 16) | (total[(c >> 0) & 1] << 24);
-    }
+    memset(monitors, 0, sizeof(monitors));
+    video_monitor_init(0);
+}
 
-    for (c = 0; c < 64; c++) {
-        cgapal[c + 64].r = (((c & 4) ? 2 : 0) | ((c & 0x10) ? 1 : 0)) * 21;
-        cgapal[c + 64].g = (((c & 2) ? 2 : 0) | ((c & 0x10) ? 1 : 0)) * 21;
-        cgapal[c + 64].b = (((c & 1) ? 2 : 0) | ((c & 0x10) ? 1 : 0)) * 21;
-        if ((c & 0x17) == 6)
-            cgapal[c + 64].g >>= 1;
-    }
-    for (c = 0; c < 64; c++) {
-        cgapal[c + 128].r = (((c & 4) ? 2 : 0) | ((c & 0x20) ? 1 : 0)) * 21;
-        cgapal[c + 128].g = (((c & 2) ? 2 : 0) | ((c & 0x10) ? 1 : 0)) * 21;
-        cgapal[c + 128].b = (((c & 1) ? 2 : 0) | ((c & 0x08) ? 1 : 0)) * 21;
+/* Called by the renderer right before it asks switchres for a new mode. */
+void
+switchres_stats_begin(void)
+{
+    int i;
+
+    for (i = 0; i < SWITCHRES_STATS_MODES; i++) {
+        if (!switchres_stats[i].count || ((switchres_stats[i].width == switchres_width) && (switchres_stats[i].height == switchres_height) && (switchres_stats[i].interlace == switchres_interlace)))
+            break;
     }
 
-    for (c = 0; c < 4; c++) {
-        for (d = 0; d < 4; d++) {
-            edatlookup[c][d] = 0;
-            if (c & 1)
-                edatlookup[c][d] |= 1;
-            if (d & 1)
-                edatlookup[c][d] |= 2;
-            if (c & 2)
-                edatlookup[c][d] |= 0x10;
-            if (d & 2)
-                edatlookup[c][d] |= 0x20;
-        }
+    if (i == SWITCHRES_STATS_MODES) {
+        switchres_stats_pending = -1;
+        return;
     }
 
-    video_6to8 = malloc(4 * 256);
-    for (c = 0; c < 256; c++)
-        video_6to8[c] = calc_6to8(c);
+    switchres_stats[i].width     = switchres_width;
+    switchres_stats[i].height    = switchres_height;
+    switchres_stats[i].interlace = switchres_interlace;
+    switchres_stats_pending      = i;
+    switchres_stats_start        = plat_get_micro_ticks();
+}
 
-    video_8togs = malloc(4 * 256);
-    for (c = 0; c < 256; c++)
-        video_8togs[c] = c | (c << 16) | (c << 24);
+/* Called by the renderer after presenting a frame, completes a pending switch. */
+void
+switchres_stats_end(void)
+{
+    int i = switchres_stats_pending;
 
-    video_8to32 = malloc(4 * 256);
-    for (c = 0; c < 256; c++)
-        video_8to32[c] = calc_8to32(c);
+    if (i < 0)
+        return;
 
-    video_15to32 = malloc(4 * 65536);
-    for (c = 0; c < 65536; c++)
-        video_15to32[c] = calc_15to32(c & 0x7fff);
+    switchres_stats[i].us[switchres_stats[i].count++ % SWITCHRES_STATS_SAMPLES] = plat_get_micro_ticks() - switchres_stats_start;
+    switchres_stats_pending = -1;
+}
 
-    video_16to32 = malloc(4 * 65536);
-    for (c = 0; c < 65536; c++)
-        video_16to32[c] = calc_16to32(c);
+static int
+switchres_stats_compare(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *) a;
+    uint32_t y = *(const uint32_t *) b;
 
-    memset(monitors, 0, sizeof(monitors));
-    video_monitor_init(0);
+    return (x > y) - (x < y);
+}
+
+static void
+switchres_stats_report(void)
+{
+    uint32_t us[SWITCHRES_STATS_SAMPLES];
+    int      i;
+    int      n;
+
+    for (i = 0; (i < SWITCHRES_STATS_MODES) && switchres_stats[i].count; i++) {
+        n = MIN(switchres_stats[i].count, SWITCHRES_STATS_SAMPLES);
+        memcpy(us, switchres_stats[i].us, n * sizeof(uint32_t));
+        qsort(us, n, sizeof(uint32_t), switchres_stats_compare);
+
+        pclog("Mode switch %dx%d%s: %d switches, p50 %u us, p99 %u us, max %u us\n",
+              switchres_stats[i].width, switchres_stats[i].height, switchres_stats[i].interlace ? "i" : "p",
+              switchres_stats[i].count, us[n / 2], us[(n * 99) / 100], us[n - 1]);
+    }
 }
 
 void
 video_close(void)
 {
-    video_monitor_close(0);
+    switchres_stats_report();
 
-    free(video_16to32);
-    free(video_15to32);
-    free(video_8to32);
-    free(video_8togs);
-    free(video_6to8);
+    video_monitor_close(0);
 
     if (fontdatksc5601) {
         free(fontdatksc5601);
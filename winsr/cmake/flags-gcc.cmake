@@ -24,12 +24,21 @@ string(APPEND CMAKE_CXX_FLAGS_DEBUG_INIT        " -ggdb -Og")
 string(APPEND CMAKE_C_FLAGS_OPTIMIZED_INIT      " -march=native -mtune=native -O3 -ffp-contract=fast -flto")
 string(APPEND CMAKE_CXX_FLAGS_OPTIMIZED_INIT    " -march=native -mtune=native -O3 -ffp-contract=fast -flto")
 
+# Profile-guided builds, see pgo.sh: INSTRUMENT writes profiles to PGO_PROFILE_DIR
+# when run, PGO is RELEASE with -flto built with them. Both must use the same build
+# directory. Like RELEASE they run on any host, tuning for this one is left to OPTIMIZED.
+set(PGO_PROFILE_DIR "${CMAKE_BINARY_DIR}/pgo" CACHE PATH "Directory the INSTRUMENT build writes profiles to and the PGO build reads them from.")
+string(APPEND CMAKE_C_FLAGS_INSTRUMENT_INIT     " -g0 -O3 -fprofile-generate=${PGO_PROFILE_DIR} -fprofile-update=prefer-atomic")
+string(APPEND CMAKE_CXX_FLAGS_INSTRUMENT_INIT   " -g0 -O3 -fprofile-generate=${PGO_PROFILE_DIR} -fprofile-update=prefer-atomic")
+string(APPEND CMAKE_C_FLAGS_PGO_INIT            " -g0 -O3 -flto -fprofile-use=${PGO_PROFILE_DIR} -fprofile-correction -fprofile-partial-training -Wno-missing-profile")
+string(APPEND CMAKE_CXX_FLAGS_PGO_INIT          " -g0 -O3 -flto -fprofile-use=${PGO_PROFILE_DIR} -fprofile-correction -fprofile-partial-training -Wno-missing-profile")
+
 # Set up the variables
 foreach(LANG C;CXX)
     set(CMAKE_${LANG}_FLAGS "$ENV{${LANG}FLAGS} ${CMAKE_${LANG}_FLAGS_INIT}" CACHE STRING "Flags used by the ${LANG} compiler during all build types.")
     mark_as_advanced(CMAKE_${LANG}_FLAGS)
 
-    foreach(CONFIG RELEASE;DEBUG;OPTIMIZED)
+    foreach(CONFIG RELEASE;DEBUG;OPTIMIZED;INSTRUMENT;PGO)
         set(CMAKE_${LANG}_FLAGS_${CONFIG} "${CMAKE_${LANG}_FLAGS_${CONFIG}_INIT}" CACHE STRING "Flags used by the ${LANG} compiler during ${CONFIG} builds.")
         mark_as_advanced(CMAKE_${LANG}_FLAGS_${CONFIG})
     endforeach()
@@ -73,10 +73,19 @@
 #include <86box/plat_dir.h>
 #include <86box/ui.h>
 #include <86box/snd_opl.h>
+#include <86box/log_queue.h>
 
 static int   cx, cy, cw, ch;
 static ini_t config;
 
+/* Background writer, see config_save_sections(). */
+static mutex_t  *config_mutex;
+static event_t  *config_wake;
+static event_t  *config_stop;
+static thread_t *config_writer;
+static int       config_writer_run;
+static int       config_pending;
+
 /* TODO: Backwards compatibility, get rid of this when enough time has passed. */
 static int backwards_compat  = 0;
 static int backwards_compat2 = 0;
@@ -200,6 +209,34 @@ load_general(void)
     video_framerate = ini_section_get_int(cat, "video_gl_framerate", -1);
     video_vsync     = ini_section_get_int(cat, "video_gl_vsync", 0);
     strncpy(video_shader, ini_section_get_string(cat, "video_gl_shader", ""), sizeof(video_shader) - 1);
+    video_null_mode = ini_section_get_int(cat, "video_null_mode", 1);
+
+    video_frame_queue = ini_section_get_int(cat, "video_frame_queue", 0);
+    if (video_frame_queue < 2)
+        video_frame_queue = 0;
+    else if (video_frame_queue > VIDEO_FRAME_QUEUE_MAX)
+        video_frame_queue = VIDEO_FRAME_QUEUE_MAX;
+    video_frame_latest = !!ini_section_get_int(cat, "video_frame_latest", 0);
+
+    input_slice_ms = ini_section_get_int(cat, "input_slice_ms", 1);
+    if ((input_slice_ms < 1) || (input_slice_ms > 10))
+        input_slice_ms = 1;
+
+    input_evdev = !!ini_section_get_int(cat, "input_evdev", 0);
+
+    speed_turbo = !!ini_section_get_int(cat, "speed_turbo", 0);
+
+    thread_cpu[PLAT_THREAD_EMU]  = ini_section_get_int(cat, "thread_cpu_emu", -1);
+    thread_cpu[PLAT_THREAD_BLIT] = ini_section_get_int(cat, "thread_cpu_blit", -1);
+    thread_cpu[PLAT_THREAD_UI]   = ini_section_get_int(cat, "thread_cpu_ui", -1);
+
+    /* Stay below the kernel's own realtime threads (interrupt handlers run at 50). */
+    thread_fifo_prio = ini_section_get_int(cat, "thread_fifo_priority", 0);
+    if ((thread_fifo_prio < 0) || (thread_fifo_prio > 49))
+        thread_fifo_prio = 0;
+
+    log_level      = ini_section_get_int(cat, "log_level", LOG_LEVEL_INFO);
+    log_timestamps = !!ini_section_get_int(cat, "log_timestamps", 0);
 
     window_remember = ini_section_get_int(cat, "window_remember", 0);
     if (window_remember) {
@@ -1836,6 +1873,12 @@ config_load(void)
 #endif
     memset(zip_drives, 0, sizeof(zip_drive_t));
 
+    if (config_mutex == NULL) {
+        config_mutex = thread_create_mutex();
+        config_wake  = thread_create_event();
+        config_stop  = thread_create_event();
+    }
+
     config = ini_read(cfg_path);
 
     if (!config) {
@@ -2097,6 +2140,58 @@ save_general(void)
         ini_section_set_string(cat, "video_gl_shader", video_shader);
     else
         ini_section_delete_var(cat, "video_gl_shader");
+    if (video_null_mode != 1)
+        ini_section_set_int(cat, "video_null_mode", video_null_mode);
+    else
+        ini_section_delete_var(cat, "video_null_mode");
+    if (video_frame_queue)
+        ini_section_set_int(cat, "video_frame_queue", video_frame_queue);
+    else
+        ini_section_delete_var(cat, "video_frame_queue");
+    if (video_frame_latest)
+        ini_section_set_int(cat, "video_frame_latest", video_frame_latest);
+    else
+        ini_section_delete_var(cat, "video_frame_latest");
+
+    if (input_slice_ms != 1)
+        ini_section_set_int(cat, "input_slice_ms", input_slice_ms);
+    else
+        ini_section_delete_var(cat, "input_slice_ms");
+    if (input_evdev)
+        ini_section_set_int(cat, "input_evdev", input_evdev);
+    else
+        ini_section_delete_var(cat, "input_evdev");
+    if (speed_turbo)
+        ini_section_set_int(cat, "speed_turbo", speed_turbo);
+    else
+        ini_section_delete_var(cat, "speed_turbo");
+
+    if (thread_cpu[PLAT_THREAD_EMU] >= 0)
+        ini_section_set_int(cat, "thread_cpu_emu", thread_cpu[PLAT_THREAD_EMU]);
+    else
+        ini_section_delete_var(cat, "thread_cpu_emu");
+    if (thread_cpu[PLAT_THREAD_BLIT] >= 0)
+        ini_section_set_int(cat, "thread_cpu_blit", thread_cpu[PLAT_THREAD_BLIT]);
+    else
+        ini_section_delete_var(cat, "thread_cpu_blit");
+    if (thread_cpu[PLAT_THREAD_UI] >= 0)
+        ini_section_set_int(cat, "thread_cpu_ui", thread_cpu[PLAT_THREAD_UI]);
+    else
+        ini_section_delete_var(cat, "thread_cpu_ui");
+    if (thread_fifo_prio)
+        ini_section_set_int(cat, "thread_fifo_priority", thread_fifo_prio);
+    else
+        ini_section_delete_var(cat, "thread_fifo_priority");
+
+    if (log_level != LOG_LEVEL_INFO)
+        ini_section_set_int(cat, "log_level", log_level);
+    else
+        ini_section_delete_var(cat, "log_level");
+
+    if (log_timestamps)
+        ini_section_set_int(cat, "log_timestamps", log_timestamps);
+    else
+        ini_section_delete_var(cat, "log_timestamps");
 
     ini_delete_section_if_empty(config, cat);
 }
@@ -2921,27 +3016,139 @@ save_other_removable_devices(void)
     ini_delete_section_if_empty(config, cat);
 }
 
+/*
+ * Write the file if anything changed, through a temporary file so a crash
+ * never leaves half of it. Only the serialization needs config_mutex: it
+ * fills the page cache, the fsync() and rename in plat_file_replace() that
+ * wait for the disk run after the mutex is released, so a save coming in
+ * meanwhile only updates the sections in memory. There is only ever one
+ * writer, the background thread or config_flush() once it has stopped it.
+ */
+static void
+config_write_pending(void)
+{
+    char     temp[1024 + 8];
+    uint32_t start = plat_get_ticks();
+    int      pending;
+
+    snprintf(temp, sizeof(temp), "%s.tmp", cfg_path);
+
+    thread_wait_mutex(config_mutex);
+    pending = config_pending;
+    if (pending) {
+        ini_write(config, temp);
+        config_pending = 0;
+    }
+    thread_release_mutex(config_mutex);
+
+    if (!pending)
+        return;
+
+    if (plat_file_replace(cfg_path, temp))
+        pclog("CONFIG: unable to write %s\n", cfg_path);
+
+    config_log("Config written in %u ms.\n", plat_get_ticks() - start);
+}
+
+static void
+config_writer_thread(void *priv)
+{
+    while (1) {
+        thread_wait_event(config_wake, -1);
+        thread_reset_event(config_wake);
+
+        if (!config_writer_run)
+            break;
+
+        /* Give the saves that usually follow a first one a chance to go out with it. */
+        thread_wait_event(config_stop, CONFIG_SAVE_DELAY);
+
+        config_write_pending();
+    }
+}
+
+/*
+ * Update the given sections in memory and have the background writer put
+ * the file on disk. Saves coming in within CONFIG_SAVE_DELAY ms of each
+ * other are written once, so mounting media does not wait for the disk.
+ */
 void
-config_save(void)
+config_save_sections(int sections)
 {
     int i;
 
-    save_general(); /* General */
-    for (i = 0; i < MONITORS_NUM; i++)
-        save_monitor(i);
-    save_machine();                 /* Machine */
-    save_video();                   /* Video */
-    save_input_devices();           /* Input devices */
-    save_sound();                   /* Sound */
-    save_network();                 /* Network */
-    save_ports();                   /* Ports (COM & LPT) */
-    save_storage_controllers();     /* Storage controllers */
-    save_hard_disks();              /* Hard disks */
-    save_floppy_and_cdrom_drives(); /* Floppy and CD-ROM drives */
-    save_other_removable_devices(); /* Other removable devices */
-    save_other_peripherals();       /* Other peripherals */
-
-    ini_write(config, cfg_path);
+    thread_wait_mutex(config_mutex);
+
+    if (sections & CONFIG_SECTION_GENERAL)
+        save_general(); /* General */
+    if (sections & CONFIG_SECTION_MONITORS) {
+        for (i = 0; i < MONITORS_NUM; i++)
+            save_monitor(i);
+    }
+    if (sections & CONFIG_SECTION_MACHINE)
+        save_machine(); /* Machine */
+    if (sections & CONFIG_SECTION_VIDEO)
+        save_video(); /* Video */
+    if (sections & CONFIG_SECTION_INPUT)
+        save_input_devices(); /* Input devices */
+    if (sections & CONFIG_SECTION_SOUND)
+        save_sound(); /* Sound */
+    if (sections & CONFIG_SECTION_NETWORK)
+        save_network(); /* Network */
+    if (sections & CONFIG_SECTION_PORTS)
+        save_ports(); /* Ports (COM & LPT) */
+    if (sections & CONFIG_SECTION_STORAGE)
+        save_storage_controllers(); /* Storage controllers */
+    if (sections & CONFIG_SECTION_HARD_DISKS)
+        save_hard_disks(); /* Hard disks */
+    if (sections & CONFIG_SECTION_FLOPPY_CDROM)
+        save_floppy_and_cdrom_drives(); /* Floppy and CD-ROM drives */
+    if (sections & CONFIG_SECTION_REMOVABLE)
+        save_other_removable_devices(); /* Other removable devices */
+    if (sections & CONFIG_SECTION_PERIPHERALS)
+        save_other_peripherals(); /* Other peripherals */
+
+    config_pending = 1;
+
+    if (config_writer == NULL) {
+        config_writer_run = 1;
+        config_writer     = thread_create(config_writer_thread, NULL);
+    }
+
+    thread_release_mutex(config_mutex);
+
+    thread_set_event(config_wake);
+}
+
+void
+config_save(void)
+{
+    config_save_sections(CONFIG_SECTION_ALL);
+}
+
+/* Write any pending changes right away and stop the background writer. */
+void
+config_flush(void)
+{
+    thread_t *writer;
+
+    if (config_mutex == NULL)
+        return;
+
+    thread_wait_mutex(config_mutex);
+    writer            = config_writer;
+    config_writer     = NULL;
+    config_writer_run = 0;
+    thread_release_mutex(config_mutex);
+
+    if (writer != NULL) {
+        thread_set_event(config_stop);
+        thread_set_event(config_wake);
+        thread_wait(writer);
+        thread_reset_event(config_stop);
+    }
+
+    config_write_pending();
 }
 
 ini_t
@@ -0,0 +1,316 @@
+/*
+ * 86Box    A hypervisor and IBM PC system emulator that specializes in
+ *          running old operating systems and software designed for IBM
+ *          PC systems and compatibles from 1981 through fairly recent
+ *          system designs based on the PCI bus.
+ *
+ *          This file is part of the 86Box distribution.
+ *
+ *          Frame hash harness.
+ *
+ *          Hashes every frame handed to the blitter and either records
+ *          the hashes (--hashrecord) or compares them with a previously
+ *          recorded file (--hashverify), so changes to the video path
+ *          can be checked for unchanged output. A script (--script) of
+ *          "<emulated ms> <monitor command>" lines drives input and
+ *          media through the monitor console at fixed emulated times:
+ *          the emulation thread stops at the sub-slice a command is due
+ *          in until the monitor thread has run it, so it takes effect
+ *          at the same emulated time on every run. The C library's
+ *          random numbers are seeded with a fixed value (--seed).
+ *          Host time per emulated second is reported on close.
+ *
+ *          Reproducible runs need a config with enable_sync = 0, the
+ *          RTC otherwise follows the host clock.
+ */
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wchar.h>
+#include <86box/86box.h>
+#include <86box/plat.h>
+#include <86box/video.h>
+#include <86box/harness.h>
+
+#define HARNESS_MAX_REPORTED 16 /* Mismatches logged individually. */
+
+/* Where the script handoff between the two threads is. */
+#define SCRIPT_QUEUED 0 /* The next command waits for its time. */
+#define SCRIPT_RUN    1 /* Due, the monitor thread runs it while emulation waits. */
+#define SCRIPT_END    2
+
+int      harness_active = 0;
+uint32_t harness_seed   = HARNESS_SEED;
+
+static FILE       *record_fp;
+static FILE       *verify_fp;
+static FILE       *script_fp;
+static atomic_uint emu_ms;
+static uint32_t    frame_num;
+static uint32_t    mismatches;
+static int         closed;
+
+/* Script handoff, the command is only written while the emulation thread
+   can not be reading it. */
+static atomic_int script_step;
+static uint32_t   script_at;
+static char       script_line[1024];
+static int        script_handed;
+
+/* Host time per emulated second. */
+static uint32_t second_start;
+static uint32_t seconds;
+static uint64_t second_total;
+static uint32_t second_max;
+
+static FILE *
+harness_open(const char *path, const char *mode)
+{
+    FILE *fp = plat_fopen(path, mode);
+
+    if (fp == NULL)
+        pclog("Harness: unable to open %s\n", path);
+
+    return fp;
+}
+
+/* Read the next script command into script_line and queue it, or end the script. */
+static void
+harness_script_read(void)
+{
+    char          line[1024];
+    unsigned long at;
+    int           pos;
+
+    while (fgets(line, sizeof(line), script_fp)) {
+        line[strcspn(line, "\r\n")] = '\0';
+
+        if ((line[0] == '\0') || (line[0] == '#'))
+            continue;
+
+        if (sscanf(line, "%lu %n", &at, &pos) < 1) {
+            pclog("Harness: bad script line \"%s\"\n", line);
+            continue;
+        }
+
+        script_at = at;
+        strcpy(script_line, line + pos);
+        atomic_store(&script_step, SCRIPT_QUEUED);
+        plat_wake_all(&script_step);
+        return;
+    }
+
+    atomic_store(&script_step, SCRIPT_END);
+    plat_wake_all(&script_step);
+}
+
+int
+harness_init(const char *record, const char *verify, const char *script)
+{
+    if (!record && !verify && !script)
+        return 1;
+
+#ifdef _WIN32
+    if (script) {
+        pclog("Harness: --script needs the monitor console, which this platform does not have\n");
+        return 0;
+    }
+#endif
+
+    if ((record && !(record_fp = harness_open(record, "w"))) || (verify && !(verify_fp = harness_open(verify, "r"))) || (script && !(script_fp = harness_open(script, "r"))))
+        return 0;
+
+    if (record_fp)
+        fprintf(record_fp, "# frame time_ms width height hash\n");
+
+    /* The first command is known before the emulation thread starts. */
+    if (script_fp)
+        harness_script_read();
+
+    atomic_init(&emu_ms, 0);
+    second_start   = plat_get_ticks();
+    harness_active = 1;
+
+    return 1;
+}
+
+/* Called by pc_run() after every block of emulated time. */
+void
+harness_tick(int block_ms)
+{
+    uint32_t prev = atomic_load(&emu_ms);
+    uint32_t ms   = prev + block_ms;
+
+    atomic_store(&emu_ms, ms);
+
+    if ((ms / 1000) != (prev / 1000)) {
+        uint32_t now  = plat_get_ticks();
+        uint32_t took = now - second_start;
+
+        seconds++;
+        second_total += took;
+        second_max   = MAX(second_max, took);
+        second_start = now;
+    }
+}
+
+uint32_t
+harness_time(void)
+{
+    return atomic_load(&emu_ms);
+}
+
+static void
+harness_check(uint32_t ms, int w, int h, uint64_t hash)
+{
+    char               line[256];
+    unsigned int       frame = 0;
+    unsigned int       exp_w = 0;
+    unsigned int       exp_h = 0;
+    unsigned long long exp   = 0;
+
+    do {
+        if (!fgets(line, sizeof(line), verify_fp)) {
+            line[0] = '\0';
+            break;
+        }
+    } while (line[0] == '#');
+
+    if ((sscanf(line, "%u %*u %u %u %llx", &frame, &exp_w, &exp_h, &exp) == 4) && (exp_w == w) && (exp_h == h) && (exp == hash))
+        return;
+
+    if (mismatches++ < HARNESS_MAX_REPORTED) {
+        if (line[0] == '\0')
+            pclog("Harness: frame %u at %u ms (%ix%i) is past the end of the recording\n", frame_num, ms, w, h);
+        else
+            pclog("Harness: frame %u at %u ms differs (%ix%i %016llx, expected %ux%u %016llx)\n",
+                  frame_num, ms, w, h, (unsigned long long) hash, exp_w, exp_h, exp);
+    }
+}
+
+/* Called on the emulation thread for every frame of the primary monitor. */
+void
+harness_frame(bitmap_t *b, int x, int y, int w, int h)
+{
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    uint32_t ms   = harness_time();
+
+    if (!record_fp && !verify_fp)
+        return;
+
+    /* FNV-1a over the visible pixels, the unused top byte is left out. */
+    for (int row = 0; row < h; row++) {
+        const uint32_t *p = &(b->line[y + row][x]);
+
+        for (int col = 0; col < w; col++)
+            hash = (hash ^ (p[col] & 0x00ffffff)) * 0x100000001b3ULL;
+    }
+
+    if (record_fp)
+        fprintf(record_fp, "%u %u %i %i %016llx\n", frame_num, ms, w, h, (unsigned long long) hash);
+    if (verify_fp)
+        harness_check(ms, w, h, hash);
+
+    frame_num++;
+}
+
+int
+harness_scripted(void)
+{
+    return script_fp != NULL;
+}
+
+/* Monitor thread: return the next script command once the emulation thread
+   has reached its time and waits for it, NULL at the end. Calling it again
+   means the previous command is done, which lets emulation go on. */
+char *
+harness_script_next(void)
+{
+    int step;
+
+    if (script_handed) {
+        script_handed = 0;
+        harness_script_read();
+    }
+
+    while ((step = atomic_load(&script_step)) != SCRIPT_RUN) {
+        if (step == SCRIPT_END)
+            return NULL;
+        plat_wait_on(&script_step, step);
+    }
+
+    script_handed = 1;
+    pclog("Harness: %u ms: %s\n", script_at, script_line);
+    return strdup(script_line);
+}
+
+/* Monitor thread: no more commands will be run, never hold up emulation again. */
+void
+harness_script_stop(void)
+{
+    if (!script_fp)
+        return;
+
+    atomic_store(&script_step, SCRIPT_END);
+    plat_wake_all(&script_step);
+}
+
+/* Emulation thread, before each sub-slice starting at emulated time ms: hand
+   every command due by then to the monitor thread and wait until it has run.
+   Returns the number of commands run. */
+int
+harness_script_run(uint32_t ms)
+{
+    int ran = 0;
+
+    while ((atomic_load(&script_step) == SCRIPT_QUEUED) && (script_at <= ms)) {
+        atomic_store(&script_step, SCRIPT_RUN);
+        plat_wake_all(&script_step);
+
+        while (atomic_load(&script_step) == SCRIPT_RUN)
+            plat_wait_on(&script_step, SCRIPT_RUN);
+
+        ran++;
+    }
+
+    return ran;
+}
+
+/* Report and close, returns the number of mismatched frames. */
+int
+harness_close(void)
+{
+    if (!harness_active || closed)
+        return mismatches;
+    closed = 1;
+
+    if (seconds)
+        pclog("Harness: %u emulated seconds, %.1f ms host time per second on average, %u ms at most\n",
+              seconds, (double) second_total / seconds, second_max);
+
+    if (record_fp) {
+        pclog("Harness: recorded %u frames\n", frame_num);
+        fclose(record_fp);
+    }
+
+    if (verify_fp) {
+        char line[256];
+
+        /* Frames recorded but never reached count as mismatches too. */
+        while (fgets(line, sizeof(line), verify_fp)) {
+            if (line[0] != '#')
+                mismatches++;
+        }
+
+        pclog("Harness: verified %u frames, %u mismatches\n", frame_num, mismatches);
+        fclose(verify_fp);
+    }
+
+    if (script_fp)
+        fclose(script_fp);
+
+    return mismatches;
+}
@@ -38,6 +38,17 @@
 /* Default language 0xFFFF = from system, 0x409 = en-US */
 #define DEFAULT_LANGUAGE 0x0409
 
+/* Threads that can be pinned to a core and given a scheduling policy. */
+#define PLAT_THREAD_EMU  0
+#define PLAT_THREAD_BLIT 1
+#define PLAT_THREAD_UI   2
+#define PLAT_THREADS     3
+
+/* Emulated block lengths picked by the speed governor, in ms. */
+#define SPEED_SLICE_MIN   10
+#define SPEED_SLICE_MAX   50
+#define SPEED_SLOW_BLOCKS 4 /* Blocks in a row behind real time before a backlog is dropped. */
+
 #ifdef MIN
 #    undef MIN
 #endif
@@ -109,6 +120,9 @@ extern int      vid_cga_contrast, /* (C) video */
     video_vsync,                  /* (C) video */
     video_b15kHz,                 /* (C) video psakhis 15khz switchres */
     video_framerate,              /* (C) video */
+    video_null_mode,              /* (C) null renderer frame handling */
+    video_frame_queue,            /* (C) frames queued for the renderer, 0 = none */
+    video_frame_latest,           /* (C) drop the oldest queued frame when full */
     gfxcard;                      /* (C) graphics/video card */
 extern char video_shader[512];    /* (C) video */
 extern int  bugger_enabled,       /* (C) enable ISAbugger */
@@ -130,6 +144,13 @@ extern int confirm_reset,         /* (C) enable reset confirmation */
     confirm_exit,                 /* (C) enable exit confirmation */
     confirm_save;                 /* (C) enable save confirmation */
 extern int enable_discord;        /* (C) enable Discord integration */
+extern int input_slice_ms;        /* (C) input sub-slice length in ms */
+extern int input_evdev;           /* (C) read Linux evdev devices directly */
+extern int speed_turbo;           /* (C) run unthrottled, skipping frames */
+extern int thread_cpu[PLAT_THREADS]; /* (C) core to pin each thread to, -1 = any */
+extern int thread_fifo_prio;      /* (C) realtime priority for them, 0 = off */
+extern int log_level;             /* (C) most detailed LOG_LEVEL_* logged */
+extern int log_timestamps;        /* (C) prefix log lines with the time */
 
 extern int is_pentium; /* TODO: Move back to cpu/cpu.h when it's figured out,
                                 how to remove that hack from the ET4000/W32p. */
@@ -155,6 +176,7 @@ extern void fatal_ex(const char *fmt, va_list);
 #endif
 extern void pclog_toggle_suppr(void);
 extern void pclog(const char *fmt, ...);
+extern void pclog_level(int level, const char *fmt, ...);
 extern void fatal(const char *fmt, ...);
 extern void set_screen_size(int x, int y);
 extern void set_screen_size_monitor(int x, int y, int monitor_index);
@@ -176,9 +198,17 @@ extern void pc_speed_changed(void);
 extern void pc_send_cad(void);
 extern void pc_send_cae(void);
 extern void pc_send_cab(void);
-extern void pc_run(void);
+extern int  pc_speed_slice(int *due);
+extern void pc_run(int ms);
 extern void pc_start(void);
 extern void pc_onesec(void);
+extern void pc_startup_stage(const char *name);
+
+extern void plat_thread_tune(int role);
+extern void plat_thread_done(int role);
+extern int  plat_file_replace(const char *dst, const char *src);
+extern void plat_wait_on(void *addr, int val);
+extern void plat_wake_all(void *addr);
 
 extern uint16_t get_last_addr(void);
 
@@ -0,0 +1,37 @@
+/*
+ * 86Box    A hypervisor and IBM PC system emulator that specializes in
+ *          running old operating systems and software designed for IBM
+ *          PC systems and compatibles from 1981 through fairly recent
+ *          system designs based on the PCI bus.
+ *
+ *          This file is part of the 86Box distribution.
+ *
+ *          Definitions for the frame hash harness.
+ */
+#ifndef EMU_HARNESS_H
+#define EMU_HARNESS_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define HARNESS_SEED 0x86b0 /* Default for --seed. */
+
+extern int      harness_active; /* Set when any harness option was given. */
+extern uint32_t harness_seed;   /* Seed for the C library's random numbers. */
+
+extern int      harness_init(const char *record, const char *verify, const char *script);
+extern int      harness_close(void);
+extern void     harness_tick(int block_ms);
+extern void     harness_frame(bitmap_t *b, int x, int y, int w, int h);
+extern uint32_t harness_time(void);
+extern int      harness_scripted(void);
+extern char    *harness_script_next(void);
+extern void     harness_script_stop(void);
+extern int      harness_script_run(uint32_t ms);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /*EMU_HARNESS_H*/
@@ -0,0 +1,75 @@
+/*
+ * 86Box    A hypervisor and IBM PC system emulator that specializes in
+ *          running old operating systems and software designed for IBM
+ *          PC systems and compatibles from 1981 through fairly recent
+ *          system designs based on the PCI bus.
+ *
+ *          This file is part of the 86Box distribution.
+ *
+ *          Definitions for the host input event queues.
+ *
+ *          Host input threads push timestamped events into their own
+ *          single-producer/single-consumer queue, the emulation thread
+ *          drains all queues between slices of emulated time.
+ */
+#ifndef EMU_INPUT_QUEUE_H
+#define EMU_INPUT_QUEUE_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+#define INPUT_QUEUE_SIZE 1024 /* Events per queue, must be a power of 2. */
+#define INPUT_QUEUE_MAX  8    /* Producers that can register a queue. */
+
+enum {
+    INPUT_EVENT_KEY = 0,     /* code = XT scancode, value = pressed */
+    INPUT_EVENT_MOUSE_MOVE,  /* value = X delta, value2 = Y delta */
+    INPUT_EVENT_MOUSE_WHEEL, /* value = Z delta */
+    INPUT_EVENT_MOUSE_BUTTON,/* code = button mask, value = pressed */
+    INPUT_EVENT_JOY_AXIS,    /* device, code = axis, value = position */
+    INPUT_EVENT_JOY_BUTTON,  /* device, code = button, value = pressed */
+    INPUT_EVENT_JOY_HAT,     /* device, code = hat, value = direction */
+    INPUT_EVENT_JOY_DEVICE   /* device, value = added */
+};
+
+typedef struct input_event_t {
+    uint32_t time; /* Host time, plat_get_micro_ticks() */
+    uint8_t  type;
+    uint8_t  device;
+    uint16_t code;
+    int32_t  value;
+    int32_t  value2;
+} input_event_t;
+
+typedef struct input_queue_t {
+    input_event_t ev[INPUT_QUEUE_SIZE];
+    atomic_uint   head;    /* Next slot to write, producer side. */
+    atomic_uint   tail;    /* Next slot to read, consumer side. */
+    atomic_uint   dropped; /* Events lost to a full queue. */
+    int           pend_dx, pend_dy, pend_dz; /* Producer side, motion not queued yet. */
+} input_queue_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Producer side. */
+extern void input_queue_register(input_queue_t *q);
+extern int  input_queue_push(input_queue_t *q, int type, int device, int code, int32_t value, int32_t value2);
+extern void input_queue_key(input_queue_t *q, int pressed, uint16_t scancode);
+extern void input_queue_mouse_move(input_queue_t *q, int dx, int dy);
+extern void input_queue_mouse_wheel(input_queue_t *q, int dz);
+extern void input_queue_mouse_button(input_queue_t *q, int mask, int pressed);
+
+/* Consumer side, emulation thread only. */
+extern void input_queue_drain(uint32_t until);
+extern void input_queue_mouse_poll(int *x, int *y, int *z, int *b);
+
+/* Platform handler for joystick events, called from input_queue_drain(). */
+extern void (*input_queue_joystick_handler)(const input_event_t *ev);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /*EMU_INPUT_QUEUE_H*/
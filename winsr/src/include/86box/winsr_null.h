@@ -0,0 +1,26 @@
+/*
+ * 86Box    A hypervisor and IBM PC system emulator that specializes in
+ *          running old operating systems and software designed for IBM
+ *          PC systems and compatibles from 1981 through fairly recent
+ *          system designs based on the PCI bus.
+ *
+ *          This file is part of the 86Box distribution.
+ *
+ *          Header file for the null rendering module.
+ */
+
+#ifndef WINSR_NULL_H
+#define WINSR_NULL_H
+
+/* video_null_mode values. */
+#define NULL_MODE_DROP 0 /* Complete frames without reading them. */
+#define NULL_MODE_COPY 1 /* Copy frames out, as a renderer upload would. */
+#define NULL_MODE_HASH 2 /* Hash frames, logged on close. */
+
+extern int  null_init(void *param);
+extern void null_close(void);
+extern int  null_pause(void);
+extern void null_set_fs(int fs);
+extern void null_blit(int x, int y, int w, int h);
+
+#endif /*!WINSR_NULL_H*/
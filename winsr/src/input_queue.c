@@ -0,0 +1,211 @@
+/*
+ * 86Box    A hypervisor and IBM PC system emulator that specializes in
+ *          running old operating systems and software designed for IBM
+ *          PC systems and compatibles from 1981 through fairly recent
+ *          system designs based on the PCI bus.
+ *
+ *          This file is part of the 86Box distribution.
+ *
+ *          Host input event queues.
+ *
+ *          Each host input source (the SDL event loop, a raw input
+ *          reader thread, ...) owns one queue and is its only writer,
+ *          the emulation thread is the only reader. Events carry the
+ *          host time they arrived at, so the emulation thread can apply
+ *          them in step with emulated time instead of all at once.
+ */
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <wchar.h>
+#include <86box/86box.h>
+#include <86box/keyboard.h>
+#include <86box/plat.h>
+#include <86box/input_queue.h>
+
+static input_queue_t *queues[INPUT_QUEUE_MAX];
+static atomic_int     queue_count = 0;
+
+/* Mouse state accumulated from the queues, read by mouse_poll(). */
+static struct {
+    int dx, dy, dz;
+    int buttons;
+} mouse_state = { 0 };
+
+void (*input_queue_joystick_handler)(const input_event_t *ev) = NULL;
+
+#ifdef ENABLE_INPUT_QUEUE_LOG
+int input_queue_do_log = ENABLE_INPUT_QUEUE_LOG;
+
+static void
+input_queue_log(const char *fmt, ...)
+{
+    va_list ap;
+
+    if (input_queue_do_log) {
+        va_start(ap, fmt);
+        pclog_ex(fmt, ap);
+        va_end(ap);
+    }
+}
+#else
+#    define input_queue_log(fmt, ...)
+#endif
+
+/* Register a producer's queue, before it pushes its first event. */
+void
+input_queue_register(input_queue_t *q)
+{
+    int n = atomic_load(&queue_count);
+
+    if (n >= INPUT_QUEUE_MAX) {
+        pclog("Input: too many input queues\n");
+        return;
+    }
+
+    atomic_init(&q->head, 0);
+    atomic_init(&q->tail, 0);
+    atomic_init(&q->dropped, 0);
+    q->pend_dx = q->pend_dy = q->pend_dz = 0;
+
+    queues[n] = q;
+    atomic_store(&queue_count, n + 1);
+}
+
+int
+input_queue_push(input_queue_t *q, int type, int device, int code, int32_t value, int32_t value2)
+{
+    unsigned int   head = atomic_load_explicit(&q->head, memory_order_relaxed);
+    unsigned int   tail = atomic_load_explicit(&q->tail, memory_order_acquire);
+    input_event_t *ev;
+
+    if ((head - tail) >= INPUT_QUEUE_SIZE) {
+        atomic_fetch_add_explicit(&q->dropped, 1, memory_order_relaxed);
+        return 0;
+    }
+
+    ev         = &q->ev[head & (INPUT_QUEUE_SIZE - 1)];
+    ev->time   = plat_get_micro_ticks();
+    ev->type   = type;
+    ev->device = device;
+    ev->code   = code;
+    ev->value  = value;
+    ev->value2 = value2;
+
+    /* Publish the slot only once it is fully written. */
+    atomic_store_explicit(&q->head, head + 1, memory_order_release);
+
+    return 1;
+}
+
+void
+input_queue_key(input_queue_t *q, int pressed, uint16_t scancode)
+{
+    if (scancode == 0)
+        return;
+
+    input_queue_push(q, INPUT_EVENT_KEY, 0, scancode, !!pressed, 0);
+}
+
+/* Motion is relative, so if the queue is full it is carried over to the next push instead of lost. */
+void
+input_queue_mouse_move(input_queue_t *q, int dx, int dy)
+{
+    q->pend_dx += dx;
+    q->pend_dy += dy;
+
+    if (input_queue_push(q, INPUT_EVENT_MOUSE_MOVE, 0, 0, q->pend_dx, q->pend_dy))
+        q->pend_dx = q->pend_dy = 0;
+}
+
+void
+input_queue_mouse_wheel(input_queue_t *q, int dz)
+{
+    q->pend_dz += dz;
+
+    if (input_queue_push(q, INPUT_EVENT_MOUSE_WHEEL, 0, 0, q->pend_dz, 0))
+        q->pend_dz = 0;
+}
+
+void
+input_queue_mouse_button(input_queue_t *q, int mask, int pressed)
+{
+    input_queue_push(q, INPUT_EVENT_MOUSE_BUTTON, 0, mask, !!pressed, 0);
+}
+
+static void
+input_queue_apply(const input_event_t *ev)
+{
+    switch (ev->type) {
+        case INPUT_EVENT_KEY:
+            keyboard_input(ev->value, ev->code);
+            break;
+
+        case INPUT_EVENT_MOUSE_MOVE:
+            mouse_state.dx += ev->value;
+            mouse_state.dy += ev->value2;
+            break;
+
+        case INPUT_EVENT_MOUSE_WHEEL:
+            mouse_state.dz += ev->value;
+            break;
+
+        case INPUT_EVENT_MOUSE_BUTTON:
+            if (ev->value)
+                mouse_state.buttons |= ev->code;
+            else
+                mouse_state.buttons &= ~ev->code;
+            break;
+
+        default:
+            if (input_queue_joystick_handler)
+                input_queue_joystick_handler(ev);
+            break;
+    }
+}
+
+/* Apply all queued events that arrived at or before the given host time, the
+   end of the current sub-slice's share of host time. Events after it stay
+   queued in order, for a later sub-slice or block. */
+void
+input_queue_drain(uint32_t until)
+{
+    int n = atomic_load(&queue_count);
+
+    for (int i = 0; i < n; i++) {
+        input_queue_t *q    = queues[i];
+        unsigned int   tail = atomic_load_explicit(&q->tail, memory_order_relaxed);
+        unsigned int   head = atomic_load_explicit(&q->head, memory_order_acquire);
+
+        while (tail != head) {
+            const input_event_t *ev = &q->ev[tail & (INPUT_QUEUE_SIZE - 1)];
+
+            /* Later events stay queued for the slice they belong to. */
+            if ((int32_t) (ev->time - until) > 0)
+                break;
+
+            input_queue_apply(ev);
+            tail++;
+        }
+
+        atomic_store_explicit(&q->tail, tail, memory_order_release);
+
+        unsigned int dropped = atomic_exchange_explicit(&q->dropped, 0, memory_order_relaxed);
+        if (dropped)
+            input_queue_log("Input: queue %i dropped %u events\n", i, dropped);
+    }
+}
+
+/* Hand the accumulated mouse state to mouse_poll(). */
+void
+input_queue_mouse_poll(int *x, int *y, int *z, int *b)
+{
+    *x = mouse_state.dx;
+    *y = mouse_state.dy;
+    *z = mouse_state.dz;
+    *b = mouse_state.buttons;
+
+    mouse_state.dx = mouse_state.dy = mouse_state.dz = 0;
+}
@@ -60,6 +60,9 @@ uint8_t svga_rotate[8][256];
 static svga_t *svga_pri;
 int            vga_on, ibm8514_on;
 
+/* Set for a monitor while the frame being drawn is going to be dropped. */
+static int svga_frame_skip[MONITORS_NUM];
+
 #ifdef ENABLE_SVGA_LOG
 int svga_do_log = ENABLE_SVGA_LOG;
 
@@ -647,6 +650,26 @@ svga_recalctimings(svga_t *svga)
 static void
 svga_do_render(svga_t *svga)
 {
+    /* The frame will be dropped, only keep the overlay and cursor line counts going. */
+    if (svga_frame_skip[svga->monitor_index]) {
+        if (svga->overlay_on) {
+            svga->overlay_on--;
+            if (svga->overlay_on && svga->interlace)
+                svga->overlay_on--;
+        }
+        if (svga->dac_hwcursor_on) {
+            svga->dac_hwcursor_on--;
+            if (svga->dac_hwcursor_on && svga->interlace)
+                svga->dac_hwcursor_on--;
+        }
+        if (svga->hwcursor_on) {
+            svga->hwcursor_on--;
+            if (svga->hwcursor_on && svga->interlace)
+                svga->hwcursor_on--;
+        }
+        return;
+    }
+
     /* Always render a blank screen and nothing else while in DPMS mode. */
     if (svga->dpms) {
         svga_render_blank(svga);
@@ -757,6 +780,7 @@ svga_poll(void *p)
             svga->ma &= svga->vram_display_mask;
             if (svga->firstline == 2000) {
                 svga->firstline = svga->displine;
+                svga_frame_skip[svga->monitor_index] = video_frame_skip(svga->monitor_index);
                 video_wait_for_buffer_monitor(svga->monitor_index);
             }
 
@@ -1518,7 +1542,7 @@ svga_doblit(int wx, int wy, svga_t *svga)
 {
     int       y_add, x_add, y_start, x_start, bottom;
     uint32_t *p;
-    int       i, j;
+    int       i;
     int       xs_temp, ys_temp;
 
     y_add   = (enable_overscan) ? svga->monitor->mon_overscan_y : 0;
@@ -1571,20 +1595,25 @@ svga_doblit(int wx, int wy, svga_t *svga)
             video_force_resize_set_monitor(0, svga->monitor_index);
     }
 
+    if (svga_frame_skip[svga->monitor_index]) {
+        /* Nothing was rendered, have the next frame repaint every line. */
+        svga_frame_skip[svga->monitor_index] = 0;
+        svga->fullchange                      = svga->monitor->mon_changeframecount;
+        if (svga->vertical_linedbl)
+            svga->vertical_linedbl >>= 1;
+        return;
+    }
+
     if ((wx >= 160) && ((wy + 1) >= 120)) {
         /* Draw (overscan_size - scroll size) lines of overscan on top and bottom. */
         for (i = 0; i < svga->y_add; i++) {
             p = &svga->monitor->target_buffer->line[i & 0x7ff][0];
-
-            for (j = 0; j < (svga->monitor->mon_xsize + x_add); j++)
-                p[j] = svga->overscan_color;
+            video_fill(p, svga->overscan_color, svga->monitor->mon_xsize + x_add);
         }
 
         for (i = 0; i < bottom; i++) {
             p = &svga->monitor->target_buffer->line[(svga->monitor->mon_ysize + svga->y_add + i) & 0x7ff][0];
-
-            for (j = 0; j < (svga->monitor->mon_xsize + x_add); j++)
-                p[j] = svga->overscan_color;
+            video_fill(p, svga->overscan_color, svga->monitor->mon_xsize + x_add);
         }
     }
 
@@ -0,0 +1,60 @@
+/*
+ * 86Box    A hypervisor and IBM PC system emulator that specializes in
+ *          running old operating systems and software designed for IBM
+ *          PC systems and compatibles from 1981 through fairly recent
+ *          system designs based on the PCI bus.
+ *
+ *          This file is part of the 86Box distribution.
+ *
+ *          Per-pixel video kernels.
+ *
+ *          Not a normal header: video.c includes it once for every
+ *          instruction set it dispatches between, with VIDEO_KERNEL(name)
+ *          giving each copy its own names and the matching target options
+ *          in effect, so the compiler vectorizes each copy for its set.
+ */
+
+/* Fill a run of pixels with one colour, used for the overscan. */
+static void
+VIDEO_KERNEL(fill)(uint32_t *p, uint32_t col, int n)
+{
+    for (int i = 0; i < n; i++)
+        p[i] = col;
+}
+
+/* video_color_transform() over a run of pixels, with the mode checks taken out of the loop. */
+static void
+VIDEO_KERNEL(transform)(uint32_t *__restrict dst, const uint32_t *__restrict src, int n)
+{
+    const uint32_t *sh;
+    uint32_t        inv = invert_display ? 0x00ffffff : 0x00000000;
+
+    if (!video_grayscale) {
+        for (int i = 0; i < n; i++)
+            dst[i] = src[i] ^ inv;
+    } else if ((video_grayscale >= 2) && (video_grayscale <= 4)) {
+        sh = shade[video_grayscale];
+        for (int i = 0; i < n; i++)
+            dst[i] = sh[video_kernel_gray(src[i], video_graytype)] ^ inv;
+    } else if (video_graytype == 0) {
+        for (int i = 0; i < n; i++)
+            dst[i] = (video_kernel_gray(src[i], 0) * 0x010101) ^ inv;
+    } else if (video_graytype == 1) {
+        for (int i = 0; i < n; i++)
+            dst[i] = (video_kernel_gray(src[i], 1) * 0x010101) ^ inv;
+    } else {
+        for (int i = 0; i < n; i++)
+            dst[i] = (video_kernel_gray(src[i], 2) * 0x010101) ^ inv;
+    }
+}
+
+/* Pack a row of pixels into the RGB bytes of a PNG row. */
+static void
+VIDEO_KERNEL(rgb24)(uint8_t *__restrict dst, const uint32_t *__restrict src, int n)
+{
+    for (int i = 0; i < n; i++) {
+        dst[i * 3]       = (src[i] >> 16) & 0xff;
+        dst[(i * 3) + 1] = (src[i] >> 8) & 0xff;
+        dst[(i * 3) + 2] = src[i] & 0xff;
+    }
+}
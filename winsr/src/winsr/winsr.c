@@ -44,6 +44,7 @@
 #include <86box/device.h>
 #include <86box/keyboard.h>
 #include <86box/mouse.h>
+#include <86box/input_queue.h>
 #include <86box/timer.h>
 #include <86box/nvr.h>
 #include <86box/video.h>
@@ -60,6 +61,7 @@
 #include <86box/gameport.h>
 #include <86box/winsr_sdl.h> //psakhis
 #include <86box/winsr_opengl.h> //psakhis
+#include <86box/winsr_null.h>
 #include <86box/version.h>
 #include <86box/gdbstub.h>
 #ifdef MTR_ENABLED
@@ -92,22 +94,12 @@ SDL_threadID    eventthread;
 
 /* win_mouse */
 int             mouse_capture; /* win_mouse */
-SDL_mutex      *mousemutex;
-typedef struct mouseinputdata {
-    int deltax, deltay, deltaz;
-    int mousebuttons;
-} mouseinputdata;
-static mouseinputdata mousedata;
+static input_queue_t ui_input;
+
 void
 mouse_poll(void)
 {
-    SDL_LockMutex(mousemutex);
-    mouse_x          = mousedata.deltax;
-    mouse_y          = mousedata.deltay;
-    mouse_z          = mousedata.deltaz;
-    mousedata.deltax = mousedata.deltay = mousedata.deltaz = 0;
-    mouse_buttons    = mousedata.mousebuttons;
-    SDL_UnlockMutex(mousemutex);
+    input_queue_mouse_poll(&mouse_x, &mouse_y, &mouse_z, &mouse_buttons);
 }
 
 static int      exit_event         = 0;
@@ -260,9 +252,10 @@ static const struct {
     void (*set_fs)(int fs);
     void (*reload)(void);
     void (*blit)(int x, int y, int w, int h);
-} vid_apis[2] = {    
+} vid_apis[3] = {    
     { "SDL_OpenGL", 1, (int (*)(void *)) sdl_initho, sdl_close, NULL, sdl_pause, NULL, sdl_set_fs, NULL, sdl_blit },
     { "OpenGL_Core", 1, (int (*)(void *)) opengl_init, opengl_close, NULL, opengl_pause, NULL, opengl_set_fs, NULL, opengl_blit },
+    { "Null", 1, null_init, null_close, NULL, null_pause, NULL, null_set_fs, NULL, null_blit },
   };
 
 extern int title_update;
@@ -519,11 +512,49 @@ ProcessCommandLine(char ***argv)
     return (argc);
 }
 
+static const char     *thread_names[PLAT_THREADS] = { "emulation", "blit", "UI" };
+static __thread uint32_t thread_start_ms;
+
+/*
+ * Pin the calling thread to its configured core. Windows has no SCHED_FIFO,
+ * a realtime priority asks for the time critical level instead.
+ */
+void
+plat_thread_tune(int role)
+{
+    thread_start_ms = plat_get_ticks();
+
+    if ((thread_cpu[role] >= 0) && !SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR) 1 << thread_cpu[role]))
+        pclog("Unable to pin the %s thread to CPU %i\n", thread_names[role], thread_cpu[role]);
+
+    if (thread_fifo_prio && !SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_TIME_CRITICAL))
+        pclog("Unable to raise the priority of the %s thread\n", thread_names[role]);
+}
+
+/* Log the CPU time used by the calling thread over its lifetime. */
+void
+plat_thread_done(int role)
+{
+    FILETIME created, exited, kernel, user;
+    uint32_t wall = plat_get_ticks() - thread_start_ms;
+    double   used;
+
+    if (!GetThreadTimes(GetCurrentThread(), &created, &exited, &kernel, &user))
+        return;
+
+    /* Both times are in 100 ns units. */
+    used = ((((uint64_t) kernel.dwHighDateTime << 32) | kernel.dwLowDateTime) + (((uint64_t) user.dwHighDateTime << 32) | user.dwLowDateTime)) / 10000.0;
+    pclog("Thread %s: %.0f ms CPU in %u ms (%.1f%%)\n", thread_names[role], used, wall,
+          wall ? (used * 100.0) / wall : 0.0);
+}
+
 void
 main_thread(void *param)
 {
     uint32_t old_time, new_time;
-    int      drawits, frames;
+    int      drawits, frames, ms;
+
+    plat_thread_tune(PLAT_THREAD_EMU);
 
     framecountx  = 0;
     title_update = 1;
@@ -539,23 +570,24 @@ main_thread(void *param)
 #endif
             drawits += (new_time - old_time);
         old_time = new_time;
-        if (drawits > 0 && !dopause) {
-            /* Yes, so do one frame now. */
-            drawits -= 10;
-            if (drawits > 50)
-                drawits = 0;
+        if (((drawits > 0) || speed_turbo) && !dopause) {
+            /* Yes, so run the time that is due now. */
+            ms = pc_speed_slice(&drawits);
 
             /* Run a block of code. */
-            pc_run();
+            pc_run(ms);
 
-            /* Every 200 frames we save the machine status. */
+            /* Every 200 frames we save the machine status. This only
+               takes a snapshot, the file is written on another thread. */
             if (++frames >= 200 && nvr_dosave) {
                 nvr_save();
                 nvr_dosave = 0;
                 frames     = 0;
             }
-        } else /* Just so we dont overload the host OS. */
+        } else {
+            /* Just so we dont overload the host OS. */
             Sleep(1);
+        }
 
         /* If needed, handle a screen resize. */        
         //Psakhis: not need on fullscreen
@@ -569,6 +601,8 @@ main_thread(void *param)
     }
 
     is_quit = 1;
+
+    plat_thread_done(PLAT_THREAD_EMU);
 }
 
 /*
@@ -592,7 +626,8 @@ do_start(void)
 
     /* Start the emulator, really. */
     thMain = thread_create(main_thread, NULL);
-    SetThreadPriority(thMain, THREAD_PRIORITY_HIGHEST);
+    if (!thread_fifo_prio)
+        SetThreadPriority(thMain, THREAD_PRIORITY_HIGHEST);
 }
 
 /* Cleanly stop the emulator. */
@@ -800,6 +835,79 @@ plat_remove(char *path)
     }
 }
 
+/* Replace dst with src in one step, once src is safely on disk. */
+int
+plat_file_replace(const char *dst, const char *src)
+{
+    wchar_t *srcw, *dstw;
+    int      len;
+    BOOL     ret;
+
+    if (acp_utf8)
+        ret = MoveFileExA(src, dst, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH);
+    else {
+        len  = mbstoc16s(NULL, src, 0) + 1;
+        srcw = malloc(len * sizeof(wchar_t));
+        mbstoc16s(srcw, src, len);
+
+        len  = mbstoc16s(NULL, dst, 0) + 1;
+        dstw = malloc(len * sizeof(wchar_t));
+        mbstoc16s(dstw, dst, len);
+
+        ret = MoveFileExW(srcw, dstw, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH);
+
+        free(srcw);
+        free(dstw);
+    }
+
+    return ret ? 0 : -1;
+}
+
+/* WaitOnAddress() needs Windows 8, look it up so Windows 7 still starts. */
+static BOOL(WINAPI *wait_on_address)(volatile VOID *addr, PVOID cmp, SIZE_T size, DWORD ms);
+static VOID(WINAPI *wake_by_address_all)(PVOID addr);
+static int wait_on_address_init = 0;
+
+static void
+plat_wait_init(void)
+{
+    HMODULE h = LoadLibraryW(L"api-ms-win-core-synch-l1-2-0.dll");
+
+    if (h != NULL) {
+        wait_on_address     = (void *) GetProcAddress(h, "WaitOnAddress");
+        wake_by_address_all = (void *) GetProcAddress(h, "WakeByAddressAll");
+    }
+    if ((wait_on_address == NULL) || (wake_by_address_all == NULL)) {
+        wait_on_address     = NULL;
+        wake_by_address_all = NULL;
+    }
+    wait_on_address_init = 1;
+}
+
+/* Sleep while the int at addr still holds val, until plat_wake_all(addr).
+   May return early, callers check their condition again. */
+void
+plat_wait_on(void *addr, int val)
+{
+    if (!wait_on_address_init)
+        plat_wait_init();
+
+    if (wait_on_address != NULL)
+        wait_on_address(addr, &val, sizeof(int), INFINITE);
+    else if (*(volatile int *) addr == val)
+        Sleep(1);
+}
+
+void
+plat_wake_all(void *addr)
+{
+    if (!wait_on_address_init)
+        plat_wait_init();
+
+    if (wake_by_address_all != NULL)
+        wake_by_address_all(addr);
+}
+
 void
 ui_sb_set_text_w(wchar_t *wstr)
 {
@@ -990,6 +1098,13 @@ plat_mmap(size_t size, uint8_t executable)
     return VirtualAlloc(NULL, size, MEM_COMMIT, executable ? PAGE_EXECUTE_READWRITE : PAGE_READWRITE);
 }
 
+void
+plat_mem_discard(void *ptr, size_t size)
+{
+    /* Contents become undefined and the pages leave the working set until touched. */
+    VirtualAlloc(ptr, size, MEM_RESET, PAGE_READWRITE);
+}
+
 void
 plat_get_global_config_dir(char* strptr)
 {
@@ -1100,6 +1215,9 @@ plat_power_off(void)
     nvr_save();
     config_save();
 
+    /* pc_close() is not reached on this path, so write it out now. */
+    config_flush();
+
     /* Deduct a sufficiently large number of cycles that no instructions will
        run before the main thread is terminated */
     cycles -= 99999999;
@@ -1134,6 +1252,7 @@ ui_sb_bugui(char *str)
 }
 
 extern void sdl_blit(int x, int y, int w, int h);
+extern void sdl_joystick_event(SDL_Event *event);
 
 int real_sdl_w, real_sdl_h;
 void
@@ -1207,17 +1326,20 @@ WinMain(HINSTANCE hInst, HINSTANCE hPrev, LPSTR lpszArg, int nCmdShow)
         fprintf(stderr, "Failed to create blit mutex: %s", SDL_GetError());
         return -1;
     }
-    mousemutex = SDL_CreateMutex();
+    input_queue_register(&ui_input);
     
     if (!vid_apis[vid_api].init(NULL))    
      return -1;            
+    pc_startup_stage("renderer");
     
     /* start machine */    
     pc_reset_hard_init();       
+    pc_startup_stage("machine");
     do_start();         
     
     /* Handle our GUI. */
     //i = ui_init(nCmdShow);    
+    plat_thread_tune(PLAT_THREAD_UI);
     SDL_AddTimer(1000, timer_onesec, NULL);
     while (!is_quit) {
         static int mouse_inside = 0;        
@@ -1233,19 +1355,14 @@ WinMain(HINSTANCE hInst, HINSTANCE hPrev, LPSTR lpszArg, int nCmdShow)
                                 event.wheel.x *= -1;
                                 event.wheel.y *= -1;
                             }
-                            SDL_LockMutex(mousemutex);
-                            mousedata.deltaz = event.wheel.y;
-                            SDL_UnlockMutex(mousemutex);
+                            input_queue_mouse_wheel(&ui_input, event.wheel.y);
                         }
                         break;
                     }
                 case SDL_MOUSEMOTION:
                     {
                         if (mouse_capture || video_fullscreen) {                         
-                            SDL_LockMutex(mousemutex);
-                            mousedata.deltax += event.motion.xrel;
-                            mousedata.deltay += event.motion.yrel;
-                            SDL_UnlockMutex(mousemutex);
+                            input_queue_mouse_move(&ui_input, event.motion.xrel, event.motion.yrel);
                         }
                         break;
                     }
@@ -1290,15 +1407,18 @@ WinMain(HINSTANCE hInst, HINSTANCE hPrev, LPSTR lpszArg, int nCmdShow)
                                     buttonmask = 16;
                                     break;
                             }
-                            SDL_LockMutex(mousemutex);
-                            if (event.button.state == SDL_PRESSED) {
-                                mousedata.mousebuttons |= buttonmask;
-                            } else
-                                mousedata.mousebuttons &= ~buttonmask;
-                            SDL_UnlockMutex(mousemutex);
+                            input_queue_mouse_button(&ui_input, buttonmask, event.button.state == SDL_PRESSED);
                         }
                         break;
                     }
+                case SDL_JOYAXISMOTION:
+                case SDL_JOYBUTTONDOWN:
+                case SDL_JOYBUTTONUP:
+                case SDL_JOYHATMOTION:
+                case SDL_JOYDEVICEADDED:
+                case SDL_JOYDEVICEREMOVED:
+                    sdl_joystick_event(&event);
+                    break;
                 case SDL_RENDER_DEVICE_RESET:
                 case SDL_RENDER_TARGETS_RESET:
                     {
@@ -1315,7 +1435,7 @@ WinMain(HINSTANCE hInst, HINSTANCE hPrev, LPSTR lpszArg, int nCmdShow)
                                 xtkey = sdl_to_xt[event.key.keysym.scancode];
                                 break;
                         }
-                        keyboard_input(event.key.state == SDL_PRESSED, xtkey);
+                        input_queue_key(&ui_input, event.key.state == SDL_PRESSED, xtkey);
                     }
                 case SDL_WINDOWEVENT:
                     {
@@ -1351,9 +1471,9 @@ WinMain(HINSTANCE hInst, HINSTANCE hPrev, LPSTR lpszArg, int nCmdShow)
         }
     }
     
+    plat_thread_done(PLAT_THREAD_UI);
     printf("\n");
     SDL_DestroyMutex(blitmtx);
-    SDL_DestroyMutex(mousemutex);
     SDL_Quit();
     
     /* Uninitialize COM before exit. */
@@ -1374,7 +1494,7 @@ plat_vidapi(char *name)
     if (!strcasecmp(name, "default") || !strcasecmp(name, "system") || !strcasecmp(name, "sdl"))
         return (0);  
 
-    for (i = 0; i < 2; i++) {
+    for (i = 0; i < 3; i++) {
         if (vid_apis[i].name && !strcasecmp(vid_apis[i].name, name))
             return (i);
     }
@@ -1396,6 +1516,9 @@ plat_vidapi_name(int api)
         case 1:
             name = "opengl_core";
             break;     
+        case 2:
+            name = "null";
+            break;
         default:
             fatal("Unknown renderer: %i\n", api);
             break;
@@ -51,7 +51,7 @@ cassette_mount(char *fn, uint8_t wp)
     ui_sb_update_icon_state(SB_CASSETTE, (fn == NULL) ? 1 : 0);
     // media_menu_update_cassette();
     ui_sb_update_tip(SB_CASSETTE);
-    config_save();
+    config_save_sections(CONFIG_SECTION_STORAGE);
 }
 
 void
@@ -62,7 +62,7 @@ cassette_eject(void)
     ui_sb_update_icon_state(SB_CASSETTE, 1);
     // media_menu_update_cassette();
     ui_sb_update_tip(SB_CASSETTE);
-    config_save();
+    config_save_sections(CONFIG_SECTION_STORAGE);
 }
 
 void
@@ -73,7 +73,7 @@ cartridge_mount(uint8_t id, char *fn, uint8_t wp)
     ui_sb_update_icon_state(SB_CARTRIDGE | id, strlen(cart_fns[id]) ? 0 : 1);
     // media_menu_update_cartridge(id);
     ui_sb_update_tip(SB_CARTRIDGE | id);
-    config_save();
+    config_save_sections(CONFIG_SECTION_STORAGE);
 }
 
 void
@@ -83,7 +83,7 @@ cartridge_eject(uint8_t id)
     ui_sb_update_icon_state(SB_CARTRIDGE | id, 1);
     // media_menu_update_cartridge(id);
     ui_sb_update_tip(SB_CARTRIDGE | id);
-    config_save();
+    config_save_sections(CONFIG_SECTION_STORAGE);
 }
 
 void
@@ -95,7 +95,7 @@ floppy_mount(uint8_t id, char *fn, uint8_t wp)
     ui_sb_update_icon_state(SB_FLOPPY | id, strlen(floppyfns[id]) ? 0 : 1);
     // media_menu_update_floppy(id);
     ui_sb_update_tip(SB_FLOPPY | id);
-    config_save();
+    config_save_sections(CONFIG_SECTION_FLOPPY_CDROM);
 }
 
 void
@@ -105,7 +105,7 @@ floppy_eject(uint8_t id)
     ui_sb_update_icon_state(SB_FLOPPY | id, 1);
     // media_menu_update_floppy(id);
     ui_sb_update_tip(SB_FLOPPY | id);
-    config_save();
+    config_save_sections(CONFIG_SECTION_FLOPPY_CDROM);
 }
 
 void
@@ -144,7 +144,7 @@ cdrom_mount(uint8_t id, char *fn)
     }
     // media_menu_update_cdrom(id);
     ui_sb_update_tip(SB_CDROM | id);
-    config_save();
+    config_save_sections(CONFIG_SECTION_FLOPPY_CDROM);
 }
 
 void
@@ -161,7 +161,7 @@ mo_eject(uint8_t id)
     ui_sb_update_icon_state(SB_MO | id, 1);
     // media_menu_update_mo(id);
     ui_sb_update_tip(SB_MO | id);
-    config_save();
+    config_save_sections(CONFIG_SECTION_REMOVABLE);
 }
 
 void
@@ -178,7 +178,7 @@ mo_mount(uint8_t id, char *fn, uint8_t wp)
     // media_menu_update_mo(id);
     ui_sb_update_tip(SB_MO | id);
 
-    config_save();
+    config_save_sections(CONFIG_SECTION_REMOVABLE);
 }
 
 void
@@ -196,7 +196,7 @@ mo_reload(uint8_t id)
     // media_menu_update_mo(id);
     ui_sb_update_tip(SB_MO | id);
 
-    config_save();
+    config_save_sections(CONFIG_SECTION_REMOVABLE);
 }
 
 void
@@ -213,7 +213,7 @@ zip_eject(uint8_t id)
     ui_sb_update_icon_state(SB_ZIP | id, 1);
     // media_menu_update_zip(id);
     ui_sb_update_tip(SB_ZIP | id);
-    config_save();
+    config_save_sections(CONFIG_SECTION_REMOVABLE);
 }
 
 void
@@ -230,7 +230,7 @@ zip_mount(uint8_t id, char *fn, uint8_t wp)
     // media_menu_update_zip(id);
     ui_sb_update_tip(SB_ZIP | id);
 
-    config_save();
+    config_save_sections(CONFIG_SECTION_REMOVABLE);
 }
 
 void
@@ -248,5 +248,5 @@ zip_reload(uint8_t id)
     // media_menu_update_zip(id);
     ui_sb_update_tip(SB_ZIP | id);
 
-    config_save();
+    config_save_sections(CONFIG_SECTION_REMOVABLE);
 }
@@ -57,8 +57,10 @@
 #endif // timersub
 
 #include <sys/time.h>
+#include <sys/stat.h>
 
 #include <stdlib.h>
+#include <math.h>
 #include <stdint.h>
 #include <string.h>
 
@@ -72,18 +74,17 @@ typedef LONG atomic_flag;
 
 #include <86box/86box.h>
 #include <86box/plat.h>
+#include <86box/thread.h>
 #include <86box/video.h>
 #include <86box/winsr_opengl.h>
 #include <86box/winsr_opengl_glslp.h>
 
 #include <86box/switchres_wrapper2.h> //psakhis
 
-static const int INIT_WIDTH   = 640;
-static const int INIT_HEIGHT  = 400;
-static const int BUFFERPIXELS = 4194304;  /* Same size as render_buffer, pow(2048 + 64, 2). */
-static const int BUFFERBYTES  = 16777216; /* Pixel is 4 bytes. */
-static const int BUFFERCOUNT  = 3;        /* How many buffers to use for pixel transfer (2-3 is commonly recommended). */
-static const int ROW_LENGTH   = 2048;     /* Source buffer row lenght (including padding) */
+static const int INIT_WIDTH      = 640;
+static const int INIT_HEIGHT     = 400;
+static const int BUFFERCOUNT     = 3;     /* How many buffers to use for pixel transfer (2-3 is commonly recommended). */
+static const int SHRINK_DELAY_MS = 10000; /* How long a smaller frame size must last before the buffers shrink. */
 
 typedef struct sdl_blit_params {
     int x, y, w, h;
@@ -100,6 +101,28 @@ static int          sr_last_height = 0;
 static double       sr_x_scale = 1.0;
 static double       sr_y_scale = 1.0;
 
+/**
+ * @brief Output geometry, recomputed when the mode or drawable changes.
+ * The viewport and the size uniforms are GL state, they are only sent
+ * again when this is marked dirty.
+ */
+static struct
+{
+    int x, y, w, h;
+    int dirty;
+} viewport = { 0, 0, 0, 0, 1 };
+
+static void
+update_viewport(void)
+{
+    /* FULLSCR_SCALE_FULL */
+    viewport.w     = (int) floor(0.5 + sr_real_width * sr_x_scale);
+    viewport.h     = (int) floor(0.5 + sr_real_height * sr_y_scale);
+    viewport.x     = (sr_last_width - viewport.w) / 2;
+    viewport.y     = (sr_last_height - viewport.h) / 2;
+    viewport.dirty = 1;
+}
+
 /**
  * @brief A dedicated OpenGL thread.
  * OpenGL context's don't handle multiple threads well.
@@ -138,6 +161,25 @@ static int video_height = 0;
 static int write_pos = 0;
 static int read_pos = 0;
 
+/**
+ * @brief Frames copied in by the blit thread and not uploaded yet.
+ */
+static atomic_int frames_queued = 0;
+
+/**
+ * @brief Pixel transfer buffer sizing.
+ * Each buffer holds one tightly packed frame. They start at the initial mode,
+ * grow when a larger frame comes in and shrink once smaller frames have been
+ * the norm for SHRINK_DELAY_MS.
+ */
+static struct
+{
+    int        bytes;       /* Size of each buffer */
+    int        request;     /* Size asked for by the blit thread, 0 if none */
+    uint32_t   shrink_time; /* When the frames became smaller than the buffers, 0 if not */
+    SDL_mutex *mutex;       /* Held while copying into or reallocating the buffers */
+} buffers = { 0 };
+
 /**
  * @brief Resize event parameters.
  */
@@ -163,6 +205,114 @@ static struct
     //mutex_t *mutex;
 } options = { 0 };
 
+/**
+ * @brief Shader file watcher.
+ * Flags the shader for recompilation whenever the file is rewritten.
+ */
+static struct
+{
+    thread_t    *thread;
+    volatile int run;
+    char         path[512]; /* Watched file, as configured */
+    char         dir[512];  /* Directory holding the file */
+    char         name[512]; /* File name within dir */
+} shader_watch = { 0 };
+
+static void
+shader_watch_notify(void)
+{
+    SDL_LockMutex(sdl_mutex);
+    options.shaderfile_changed = 1;
+    SDL_UnlockMutex(sdl_mutex);
+}
+
+/**
+ * @brief Watcher thread, waits on change notifications of the shader directory.
+ * Notifications are per directory, the file's timestamp filters out unrelated changes.
+ */
+static void
+shader_watch_thread(void *param)
+{
+    struct stat st;
+    time_t      last = 0;
+
+    if (!stat(shader_watch.path, &st))
+        last = st.st_mtime;
+
+    HANDLE handle = FindFirstChangeNotificationA(shader_watch.dir, FALSE, FILE_NOTIFY_CHANGE_LAST_WRITE | FILE_NOTIFY_CHANGE_FILE_NAME);
+
+    if (handle == INVALID_HANDLE_VALUE) {
+        pclog("OpenGL: unable to watch %s (%lu)\n", shader_watch.dir, GetLastError());
+        return;
+    }
+
+    while (shader_watch.run) {
+        /* Wake up periodically to notice a stop request. */
+        if (WaitForSingleObject(handle, 250) != WAIT_OBJECT_0)
+            continue;
+
+        if (!stat(shader_watch.path, &st) && (st.st_mtime != last)) {
+            last = st.st_mtime;
+            shader_watch_notify();
+        }
+
+        if (!FindNextChangeNotification(handle))
+            break;
+    }
+
+    FindCloseChangeNotification(handle);
+}
+
+/**
+ * @brief Stop watching the shader file.
+ * Must not be called with sdl_mutex held, the watcher takes it to flag a change.
+ */
+static void
+shader_watch_stop(void)
+{
+    if (shader_watch.thread == NULL)
+        return;
+
+    shader_watch.run = 0;
+    thread_wait(shader_watch.thread);
+    shader_watch.thread = NULL;
+}
+
+/**
+ * @brief (Re-)start watching a shader file, an empty path only stops the watcher.
+ */
+static void
+shader_watch_start(const char *path)
+{
+    shader_watch_stop();
+
+    if (path[0] == '\0')
+        return;
+
+    snprintf(shader_watch.path, sizeof(shader_watch.path), "%s", path);
+    snprintf(shader_watch.dir, sizeof(shader_watch.dir), "%s", path);
+
+    char *slash = strrchr(shader_watch.dir, '/');
+    char *bslash = strrchr(shader_watch.dir, '\\');
+
+    if (bslash > slash)
+        slash = bslash;
+
+    if (slash == NULL) {
+        snprintf(shader_watch.name, sizeof(shader_watch.name), "%s", path);
+        strcpy(shader_watch.dir, ".");
+    } else {
+        snprintf(shader_watch.name, sizeof(shader_watch.name), "%s", slash + 1);
+        if (slash == shader_watch.dir)
+            slash[1] = '\0'; /* Keep the root directory. */
+        else
+            slash[0] = '\0';
+    }
+
+    shader_watch.run    = 1;
+    shader_watch.thread = thread_create(shader_watch_thread, NULL);
+}
+
 /**
  * @brief Identifiers to OpenGL objects and uniforms.
  */
@@ -186,23 +336,28 @@ gl_identifiers gl = { 0 };
 
 /**
  * @brief (Re-)apply shaders to OpenGL context.
+ * When changing shaders, the current program stays in use if the new one fails to build.
  * @param gl Identifiers from initialize
  */
 static void
 apply_shaders(gl_identifiers *gl)
 {
-    GLuint old_shader_ID = 0;
+    GLuint old_shader_ID = gl->shader_progID;
+    GLuint new_shader_ID = 0;
 
-    if (gl->shader_progID != 0)
-        old_shader_ID = gl->shader_progID;
+    if (strlen(options.shaderfile) > 0) {
+        new_shader_ID = load_custom_shaders(options.shaderfile);
 
-    if (strlen(options.shaderfile) > 0)
-        gl->shader_progID = load_custom_shaders(options.shaderfile);
-    else
-        gl->shader_progID = 0;
+        if ((new_shader_ID == 0) && (old_shader_ID != 0)) {
+            pclog("OpenGL: keeping current shader, %s failed to build.\n", options.shaderfile);
+            return;
+        }
+    }
+
+    if (new_shader_ID == 0)
+        new_shader_ID = load_default_shaders();
 
-    if (gl->shader_progID == 0)
-        gl->shader_progID = load_default_shaders();
+    gl->shader_progID = new_shader_ID;
 
     glUseProgram(gl->shader_progID);
 
@@ -249,6 +404,124 @@ apply_shaders(gl_identifiers *gl)
     gl->frame_count  = glGetUniformLocation(gl->shader_progID, "FrameCount");
 }
 
+/**
+ * @brief Release the pixel transfer buffers.
+ * @param gl Identifiers from initialize
+ */
+static void
+release_pixel_buffers(gl_identifiers *gl)
+{
+    if (gl->unpackBufferID == 0)
+        return;
+
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, gl->unpackBufferID);
+
+    if (GLAD_GL_ARB_buffer_storage)
+        glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+    else
+        free(blit_info[0].buffer);
+
+    glDeleteBuffers(1, &gl->unpackBufferID);
+    gl->unpackBufferID = 0;
+
+    for (int i = 0; i < BUFFERCOUNT; i++) {
+        blit_info[i].buffer = NULL;
+        blit_info[i].w      = 0;
+        blit_info[i].h      = 0;
+    }
+
+    buffers.bytes = 0;
+}
+
+/**
+ * @brief (Re-)allocate the pixel transfer buffers.
+ * Storage of a persistent buffer is immutable, so a new buffer object is created each time.
+ * @param gl Identifiers from initialize
+ * @param bytes Size of each buffer
+ * @return 1 on success, 0 on failure (buffers are left released)
+ */
+static int
+allocate_pixel_buffers(gl_identifiers *gl, int bytes)
+{
+    void *buf_ptr = NULL;
+
+    release_pixel_buffers(gl);
+
+    glGenBuffers(1, &gl->unpackBufferID);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, gl->unpackBufferID);
+
+    if (GLAD_GL_ARB_buffer_storage) {
+        /* Create persistent buffer for pixel transfer. */
+        glBufferStorage(GL_PIXEL_UNPACK_BUFFER, (GLsizeiptr) bytes * BUFFERCOUNT, NULL, GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT);
+
+        buf_ptr = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, (GLsizeiptr) bytes * BUFFERCOUNT, GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT);
+    } else {
+        /* Fallback; create our own buffer. */
+        buf_ptr = malloc((size_t) bytes * BUFFERCOUNT);
+
+        glBufferData(GL_PIXEL_UNPACK_BUFFER, (GLsizeiptr) bytes * BUFFERCOUNT, NULL, GL_STREAM_DRAW);
+    }
+
+    if (buf_ptr == NULL) {
+        /* Most likely out of memory. */
+        glDeleteBuffers(1, &gl->unpackBufferID);
+        gl->unpackBufferID = 0;
+        return 0;
+    }
+
+    /* Split the buffer area for each blit_info and set them available for use. */
+    for (int i = 0; i < BUFFERCOUNT; i++) {
+        blit_info[i].buffer = (byte *) buf_ptr + (size_t) bytes * i;
+        blit_info[i].w      = 0;
+        blit_info[i].h      = 0;
+        atomic_flag_clear(&blit_info[i].in_use);
+    }
+    atomic_store(&frames_queued, 0);
+
+    buffers.bytes = bytes;
+    write_pos     = 0;
+    read_pos      = 0;
+
+    return 1;
+}
+
+/**
+ * @brief Grow or shrink the pixel transfer buffers to the current frame size.
+ * Frames queued in the old buffers are dropped.
+ * @param gl Identifiers from initialize
+ */
+static void
+update_pixel_buffers(gl_identifiers *gl)
+{
+    int      needed = video_width * video_height * sizeof(uint32_t);
+    int      bytes  = 0;
+    uint32_t now    = plat_get_ticks();
+
+    SDL_LockMutex(buffers.mutex);
+
+    if (buffers.request > buffers.bytes) {
+        bytes = buffers.request;
+    } else if ((needed > 0) && (needed < buffers.bytes)) {
+        if (!buffers.shrink_time)
+            buffers.shrink_time = now | 1;
+        else if ((now - buffers.shrink_time) >= SHRINK_DELAY_MS)
+            bytes = needed;
+    } else
+        buffers.shrink_time = 0;
+
+    if (bytes) {
+        pclog("OpenGL: pixel transfer buffers %d -> %d bytes\n", buffers.bytes * BUFFERCOUNT, bytes * BUFFERCOUNT);
+
+        if (!allocate_pixel_buffers(gl, bytes))
+            pclog("OpenGL: failed to allocate pixel transfer buffers.\n");
+
+        buffers.request     = 0;
+        buffers.shrink_time = 0;
+    }
+
+    SDL_UnlockMutex(buffers.mutex);
+}
+
 /**
  * @brief Initialize OpenGL context
  * @return Identifiers
@@ -284,37 +557,36 @@ initialize_glcontext(gl_identifiers *gl)
 
     glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, INIT_WIDTH, INIT_HEIGHT, 0, GL_BGRA, GL_UNSIGNED_INT_8_8_8_8_REV, NULL);
 
-    glGenBuffers(1, &gl->unpackBufferID);
-    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, gl->unpackBufferID);
+    if (!allocate_pixel_buffers(gl, INIT_WIDTH * INIT_HEIGHT * sizeof(uint32_t)))
+        return 0;
 
-    void *buf_ptr = NULL;
+    glClearColor(0.f, 0.f, 0.f, 1.f);
 
-    if (GLAD_GL_ARB_buffer_storage) {
-        /* Create persistent buffer for pixel transfer. */
-        glBufferStorage(GL_PIXEL_UNPACK_BUFFER, BUFFERBYTES * BUFFERCOUNT, NULL, GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT);
+    apply_shaders(gl);
 
-        buf_ptr = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, BUFFERBYTES * BUFFERCOUNT, GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT);
-    } else {
-        /* Fallback; create our own buffer. */
-        buf_ptr = malloc(BUFFERBYTES * BUFFERCOUNT);
+    return 1;
+}
 
-        glBufferData(GL_PIXEL_UNPACK_BUFFER, BUFFERBYTES * BUFFERCOUNT, NULL, GL_STREAM_DRAW);
+/**
+ * @brief Apply option changes made since the last frame.
+ * Runs on the rendering side between frames, with sdl_mutex held.
+ */
+static void
+apply_options(gl_identifiers *gl)
+{
+    if (options.shaderfile_changed) {
+        options.shaderfile_changed = 0;
+        pclog("OpenGL: reloading shader %s\n", options.shaderfile[0] ? options.shaderfile : "(default)");
+        apply_shaders(gl);
+        /* Uniform values belong to the program, set them again. */
+        viewport.dirty = 1;
     }
 
-    if (buf_ptr == NULL)
-        return 0; /* Most likely out of memory. */
-
-    /* Split the buffer area for each blit_info and set them available for use. */
-    for (int i = 0; i < BUFFERCOUNT; i++) {
-        blit_info[i].buffer = (byte *) buf_ptr + BUFFERBYTES * i;
-        atomic_flag_clear(&blit_info[i].in_use);
+    if (options.filter_changed) {
+        options.filter_changed = 0;
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, options.filter ? GL_LINEAR : GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, options.filter ? GL_LINEAR : GL_NEAREST);
     }
-
-    glClearColor(0.f, 0.f, 0.f, 1.f);
-
-    apply_shaders(gl);
-
-    return 1;
 }
 
 /**
@@ -324,13 +596,9 @@ initialize_glcontext(gl_identifiers *gl)
 static void
 finalize_glcontext(gl_identifiers *gl)
 {
-    if (GLAD_GL_ARB_buffer_storage)
-        glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
-    else
-        free(blit_info[0].buffer);
+    release_pixel_buffers(gl);
 
     glDeleteProgram(gl->shader_progID);
-    glDeleteBuffers(1, &gl->unpackBufferID);
     glDeleteTextures(1, &gl->textureID);
     glDeleteBuffers(1, &gl->vertexBufferID);
     glDeleteVertexArrays(1, &gl->vertexArrayID);
@@ -427,9 +695,14 @@ static void __stdcall opengl_debugmsg_callback(GLenum source, GLenum type, GLuin
 */
 
 void
-opengl_real_blit(int x, int y, int w, int h)
+opengl_real_blit(void)
 {
       blit_info_t *info = &blit_info[read_pos];                 
+
+      /* Nothing written since the buffers were (re)allocated. */
+      if ((info->w <= 0) || (info->h <= 0))
+          return;
+
       /* Resize the texture */
       if (video_width != info->w || video_height != info->h) {
       	 video_width = info->w;
@@ -437,22 +710,31 @@ opengl_real_blit(int x, int y, int w, int h)
          glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
          glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, video_width, video_height, 0, GL_BGRA, GL_UNSIGNED_INT_8_8_8_8_REV, NULL);
          glBindBuffer(GL_PIXEL_UNPACK_BUFFER, gl.unpackBufferID);
+         viewport.dirty = 1;
+      }
+
+      if (viewport.dirty) {
+         glViewport(viewport.x, viewport.y, viewport.w, viewport.h);
+
+         /* The texture is sized to the frame, input and texture size are the same. */
+         if (gl.output_size != -1)
+            glUniform2f(gl.output_size, viewport.w, viewport.h);
+         if (gl.input_size != -1)
+            glUniform2f(gl.input_size, video_width, video_height);
+         if (gl.texture_size != -1)
+            glUniform2f(gl.texture_size, video_width, video_height);
+
+         viewport.dirty = 0;
       }
-           
-      glViewport(x, y, w, h);
-      
-      if (gl.output_size != -1)
-       glUniform2f(gl.output_size, w, h);
       
       if (!GLAD_GL_ARB_buffer_storage) {
         /* Fallback method, copy data to pixel buffer. */
-        glBufferSubData(GL_PIXEL_UNPACK_BUFFER, BUFFERBYTES * read_pos, info->h * ROW_LENGTH * sizeof(uint32_t), info->buffer);
+        glBufferSubData(GL_PIXEL_UNPACK_BUFFER, (GLintptr) buffers.bytes * read_pos, info->h * info->w * sizeof(uint32_t), info->buffer);
       }
       
-      /* Update texture from pixel buffer. */
-      glPixelStorei(GL_UNPACK_SKIP_PIXELS, BUFFERPIXELS * read_pos);
-      glPixelStorei(GL_UNPACK_ROW_LENGTH, ROW_LENGTH);
-      glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, info->w, info->h, GL_BGRA, GL_UNSIGNED_INT_8_8_8_8_REV, NULL);
+      /* Update texture from pixel buffer, rows are tightly packed. */
+      glPixelStorei(GL_UNPACK_ROW_LENGTH, info->w);
+      glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, info->w, info->h, GL_BGRA, GL_UNSIGNED_INT_8_8_8_8_REV, (void *) ((uintptr_t) buffers.bytes * read_pos));
                             	
       glFinish();
       
@@ -464,6 +746,8 @@ opengl_real_blit(int x, int y, int w, int h)
       }*/    
         	         
       atomic_flag_clear(&info->in_use);
+      if (atomic_load(&frames_queued) > 0)
+         atomic_fetch_sub(&frames_queued, 1);
                     
       read_pos = (read_pos + 1) % BUFFERCOUNT;	
 	
@@ -479,6 +763,7 @@ opengl_blit(int x, int y, int w, int h)
     sr_mode swres_result;      	           
     if (switchres_switch) {   
         pclog("Mode detected %dx%d@%f (%d)\n",switchres_width,switchres_height,switchres_freq,switchres_interlace);                
+        switchres_stats_begin();
         struct timeval tval_before, tval_after, tval_result;
         gettimeofday(&tval_before, NULL);
         
@@ -502,24 +787,29 @@ opengl_blit(int x, int y, int w, int h)
         sr_x_scale = swres_result.x_scale;               
         sr_y_scale = swres_result.y_scale;               
         switchres_switch = 0; 
+        update_viewport();
         
         gettimeofday(&tval_after, NULL);
         timersub(&tval_after, &tval_before, &tval_result);
         pclog("Mode applied, time elapsed: %ld.%06ld\n", (long int)tval_result.tv_sec, (long int)tval_result.tv_usec);
     }                
     //end psakhis
-    //FULLSCR_SCALE_FULL 
-    int ww = floor(0.5 + sr_real_width * sr_x_scale);
-    int hh = floor(0.5 + sr_real_height * sr_y_scale);   
-    int xx = (sr_last_width - ww) / 2;
-    int yy = (sr_last_height - hh) / 2;
-    
-    opengl_real_blit(xx, yy, ww, hh); 
+    apply_options(&gl);
+    update_pixel_buffers(&gl);
+    opengl_real_blit(); 
     render_and_swap(&gl);    
+    switchres_stats_end();
     blitreq = 0;    
     SDL_UnlockMutex(sdl_mutex);       
 }
 
+/* With every buffer still waiting to be uploaded the shim would drop the next frame. */
+static int
+opengl_blit_drop(int monitor_index)
+{
+    return (monitor_index == 0) && (atomic_load(&frames_queued) >= BUFFERCOUNT);
+}
+
 void
 opengl_blit_shim(int x, int y, int w, int h, int monitor_index)
 {   
@@ -530,32 +820,46 @@ opengl_blit_shim(int x, int y, int w, int h, int monitor_index)
     
     int row;    
             
-    if ((x < 0) || (y < 0) || (w <= 0) || (h <= 0) || (w > 2048) || (h > 2048) || (buffer32 == NULL) || (!opengl_enabled) || monitor_index >= 1) {      
+    if ((x < 0) || (y < 0) || (w <= 0) || (h <= 0) || (w > 2048) || (h > 2048) || (blit_buffer32 == NULL) || (!opengl_enabled) || monitor_index >= 1) {      
     	video_blit_complete_monitor(monitor_index);
         return;                
     } 
     
+    SDL_LockMutex(buffers.mutex);
+
+    if ((int) (w * h * sizeof(uint32_t)) > buffers.bytes) {
+       /* Frame does not fit, have the renderer grow the buffers and drop this one. */
+       buffers.request = MAX(buffers.request, (int) (w * h * sizeof(uint32_t)));
+       SDL_UnlockMutex(buffers.mutex);
+       blitreq = 1;
+       video_blit_complete_monitor(monitor_index);
+       return;
+    }
+
     int full_buffered = atomic_flag_test_and_set(&blit_info[write_pos].in_use);
     if (full_buffered) {
+       SDL_UnlockMutex(buffers.mutex);
        blitreq = 1; 
        video_blit_complete_monitor(monitor_index);  
        return;     
     } 
     
     for (row = 0; row < h; ++row)
-        video_copy(&(((uint8_t *) blit_info[write_pos].buffer)[row * ROW_LENGTH * sizeof(uint32_t)]), &(buffer32->line[y + row][x]), w * sizeof(uint32_t));
+        video_copy(&(((uint8_t *) blit_info[write_pos].buffer)[row * w * sizeof(uint32_t)]), &(blit_buffer32->line[y + row][x]), w * sizeof(uint32_t));
     
     blit_info[write_pos].w = w;
     blit_info[write_pos].h = h;        
     
     if (monitors[0].mon_screenshots)
-        video_screenshot(blit_info[write_pos].buffer, 0, 0, ROW_LENGTH);
+        video_screenshot(blit_info[write_pos].buffer, 0, 0, w);
             
     /* Add fence to track when above gl commands are complete. */
     /*if (GLAD_GL_ARB_sync)    
        blit_info[write_pos].sync = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
     */    
     write_pos = (write_pos + 1) % BUFFERCOUNT;            
+    atomic_fetch_add(&frames_queued, 1);
+    SDL_UnlockMutex(buffers.mutex);
     blitreq = 1;              
     video_blit_complete_monitor(monitor_index);
 }
@@ -678,6 +982,8 @@ opengl_init(void)
 
     write_pos = 0;    
     read_pos = 0;
+
+    buffers.mutex = SDL_CreateMutex();
     
     if (!initialize_glcontext(&gl)) {
         pclog("OpenGL: failed to initialize.\n");
@@ -709,6 +1015,7 @@ opengl_init(void)
     sr_real_width = 640;
     sr_real_height = 480; 
     SDL_GL_GetDrawableSize(sdl_win, &sr_last_width, &sr_last_height);  
+    update_viewport();
     //end psakhis
                          
     opengl_enabled = 1;
@@ -716,7 +1023,10 @@ opengl_init(void)
     atexit(opengl_close);     
     atexit(sr_deinit);   
 
+    shader_watch_start(options.shaderfile);
+
     video_setblit(opengl_blit_shim);
+    video_setblitdrop(opengl_blit_drop);
             
     return 1;
 }
@@ -730,10 +1040,13 @@ opengl_pause(void)
 void
 opengl_close(void)
 {
+   shader_watch_stop();
+
    if (sdl_mutex != NULL)
      SDL_LockMutex(sdl_mutex);   
    
    video_setblit(NULL);
+   video_setblitdrop(NULL);
        
    if (opengl_enabled) {  
       opengl_enabled = 0;      
@@ -755,6 +1068,11 @@ opengl_close(void)
         SDL_DestroyMutex(sdl_mutex);
         sdl_mutex = NULL;
    }
+
+   if (buffers.mutex != NULL) {
+        SDL_DestroyMutex(buffers.mutex);
+        buffers.mutex = NULL;
+   }
     
    SDL_Quit();       
 
@@ -773,11 +1091,42 @@ opengl_set_fs(int fs)
 void
 opengl_resize(int w, int h)
 {
-
+    if (!opengl_enabled)
+        return;
+
+    SDL_LockMutex(sdl_mutex);
+    if (!video_fullscreen)
+        SDL_SetWindowSize(sdl_win, w, h);
+    /* Blits are centered on the drawable, track its new size. */
+    SDL_GL_GetDrawableSize(sdl_win, &sr_last_width, &sr_last_height);
+    update_viewport();
+    SDL_UnlockMutex(sdl_mutex);
 }
 
+/**
+ * @brief Pick up shader and filter settings changed in the configuration.
+ * The changes are applied by the next blit.
+ */
 void
 opengl_reload(void)
 {
-   
+    int path_changed;
+
+    if (!opengl_enabled)
+        return;
+
+    SDL_LockMutex(sdl_mutex);
+    path_changed = strcmp(options.shaderfile, video_shader) != 0;
+    if (path_changed) {
+        snprintf(options.shaderfile, sizeof(options.shaderfile), "%s", video_shader);
+        options.shaderfile_changed = 1;
+    }
+    if (options.filter != video_filter_method) {
+        options.filter         = video_filter_method;
+        options.filter_changed = 1;
+    }
+    SDL_UnlockMutex(sdl_mutex);
+
+    if (path_changed)
+        shader_watch_start(video_shader);
 }
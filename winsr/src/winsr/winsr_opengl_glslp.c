@@ -31,15 +31,18 @@
  * along with this program; if not, write to the Free Software
  * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
  */
+#include <SDL2/SDL.h>
 #include <glad/glad.h>
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
+#include <inttypes.h>
 
 #include <86box/86box.h>
 #include <86box/plat.h>
+#include <86box/path.h>
 #include <86box/winsr_opengl_glslp.h>
 
 /**
@@ -74,6 +77,236 @@ typedef enum {
     OPENGL_BUILD_TARGET_LINK
 } opengl_build_target_t;
 
+/* GL_ARB_get_program_binary, not part of the generated loader. */
+#ifndef GL_PROGRAM_BINARY_RETRIEVABLE_HINT
+#    define GL_PROGRAM_BINARY_RETRIEVABLE_HINT 0x8257
+#endif
+#ifndef GL_PROGRAM_BINARY_LENGTH
+#    define GL_PROGRAM_BINARY_LENGTH 0x8741
+#endif
+#ifndef GL_NUM_PROGRAM_BINARY_FORMATS
+#    define GL_NUM_PROGRAM_BINARY_FORMATS 0x87FE
+#endif
+
+typedef void(APIENTRYP shader_cache_get_binary_t)(GLuint program, GLsizei bufSize, GLsizei *length, GLenum *binaryFormat, void *binary);
+typedef void(APIENTRYP shader_cache_program_binary_t)(GLuint program, GLenum binaryFormat, const void *binary, GLsizei length);
+typedef void(APIENTRYP shader_cache_parameteri_t)(GLuint program, GLenum pname, GLint value);
+
+#define SHADER_CACHE_DIR   "shader_cache"
+#define SHADER_CACHE_MAGIC "86BSHDR1"
+
+/**
+ * @brief Header of an on-disk program binary, followed by the binary itself.
+ */
+typedef struct {
+    char     magic[8];
+    uint64_t key;
+    uint32_t format;
+    uint32_t length;
+} shader_cache_header_t;
+
+/**
+ * @brief Program binary entry points, resolved for the current context.
+ */
+static struct {
+    shader_cache_get_binary_t     get_binary;
+    shader_cache_program_binary_t program_binary;
+    shader_cache_parameteri_t     parameteri;
+} shader_cache = { 0 };
+
+/**
+ * @brief Resolves the program binary entry points for the current context.
+ * @return 1 if binaries can be saved and restored, 0 otherwise.
+ */
+static int
+shader_cache_available(void)
+{
+    GLint formats = 0;
+
+    if (!SDL_GL_ExtensionSupported("GL_ARB_get_program_binary"))
+        return 0;
+
+    shader_cache.get_binary     = (shader_cache_get_binary_t) SDL_GL_GetProcAddress("glGetProgramBinary");
+    shader_cache.program_binary = (shader_cache_program_binary_t) SDL_GL_GetProcAddress("glProgramBinary");
+    shader_cache.parameteri     = (shader_cache_parameteri_t) SDL_GL_GetProcAddress("glProgramParameteri");
+
+    if (!shader_cache.get_binary || !shader_cache.program_binary || !shader_cache.parameteri)
+        return 0;
+
+    /* Drivers may expose the extension without supporting any format. */
+    glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+
+    return formats > 0;
+}
+
+/**
+ * @brief FNV-1a hash, chained through the seed.
+ */
+static uint64_t
+shader_cache_hash(uint64_t hash, const char *str)
+{
+    if (str == NULL)
+        return hash;
+
+    while (*str) {
+        hash ^= (uint8_t) *str++;
+        hash *= 0x100000001b3ULL;
+    }
+
+    /* Separate the fields so that "ab" + "c" differs from "a" + "bc". */
+    hash ^= 0xff;
+    hash *= 0x100000001b3ULL;
+
+    return hash;
+}
+
+/**
+ * @brief Builds the cache key from the driver identity and full shader sources.
+ */
+static uint64_t
+shader_cache_key(const char **vertex_sources, const char **fragment_sources)
+{
+    uint64_t hash = 0xcbf29ce484222325ULL;
+
+    hash = shader_cache_hash(hash, (const char *) glGetString(GL_VENDOR));
+    hash = shader_cache_hash(hash, (const char *) glGetString(GL_RENDERER));
+    hash = shader_cache_hash(hash, (const char *) glGetString(GL_VERSION));
+
+    for (int i = 0; i < 3; i++) {
+        hash = shader_cache_hash(hash, vertex_sources[i]);
+        hash = shader_cache_hash(hash, fragment_sources[i]);
+    }
+
+    return hash;
+}
+
+static void
+shader_cache_path(char *dest, uint64_t key)
+{
+    char name[32];
+
+    sprintf(name, "%016" PRIx64 ".bin", key);
+
+    path_append_filename(dest, usr_path, SHADER_CACHE_DIR);
+    path_slash(dest);
+    strcat(dest, name);
+}
+
+/**
+ * @brief Restores a program from the cache.
+ * @return Linked program identifier or 0 on a miss.
+ */
+static GLuint
+shader_cache_load(uint64_t key)
+{
+    char                  path[1024];
+    shader_cache_header_t header;
+    GLint                 status = GL_FALSE;
+    GLuint                prog_id;
+
+    shader_cache_path(path, key);
+
+    FILE *fp = plat_fopen(path, "rb");
+
+    if (fp == NULL)
+        return 0;
+
+    if ((fread(&header, sizeof(header), 1, fp) != 1) || memcmp(header.magic, SHADER_CACHE_MAGIC, 8) || (header.key != key) || (header.length == 0)) {
+        fclose(fp);
+        return 0;
+    }
+
+    void *binary = malloc(header.length);
+
+    if (binary == NULL) {
+        fclose(fp);
+        return 0;
+    }
+
+    if (fread(binary, 1, header.length, fp) != header.length) {
+        free(binary);
+        fclose(fp);
+        return 0;
+    }
+
+    fclose(fp);
+
+    prog_id = glCreateProgram();
+    shader_cache.program_binary(prog_id, header.format, binary, header.length);
+    free(binary);
+
+    /* Driver updates invalidate binaries without changing the version string on some stacks. */
+    glGetProgramiv(prog_id, GL_LINK_STATUS, &status);
+
+    if (status == GL_FALSE) {
+        glDeleteProgram(prog_id);
+        return 0;
+    }
+
+    return prog_id;
+}
+
+/**
+ * @brief Stores a linked program in the cache, failures are not fatal.
+ */
+static void
+shader_cache_store(GLuint prog_id, uint64_t key)
+{
+    char                  path[1024];
+    char                  tmp_path[1024 + 4];
+    shader_cache_header_t header;
+    GLint                 length = 0;
+    GLsizei               written = 0;
+    GLenum                format  = 0;
+
+    glGetProgramiv(prog_id, GL_PROGRAM_BINARY_LENGTH, &length);
+
+    if (length <= 0)
+        return;
+
+    void *binary = malloc(length);
+
+    if (binary == NULL)
+        return;
+
+    shader_cache.get_binary(prog_id, length, &written, &format, binary);
+
+    if (written <= 0) {
+        free(binary);
+        return;
+    }
+
+    path_append_filename(path, usr_path, SHADER_CACHE_DIR);
+    if (!plat_dir_check(path))
+        plat_dir_create(path);
+
+    shader_cache_path(path, key);
+    sprintf(tmp_path, "%s.tmp", path);
+
+    memcpy(header.magic, SHADER_CACHE_MAGIC, 8);
+    header.key    = key;
+    header.format = format;
+    header.length = written;
+
+    /* Write aside and rename, so a crash never leaves a truncated entry behind. */
+    FILE *fp = plat_fopen(tmp_path, "wb");
+
+    if (fp != NULL) {
+        int ok = (fwrite(&header, sizeof(header), 1, fp) == 1) && (fwrite(binary, 1, written, fp) == (size_t) written);
+
+        fclose(fp);
+
+        if (ok) {
+            remove(path);
+            ok = !rename(tmp_path, path);
+        }
+        if (!ok)
+            remove(tmp_path);
+    }
+
+    free(binary);
+}
+
 /**
  * @brief Reads a whole file into a null terminated string.
  * @param Path Path to the file relative to executable path.
@@ -163,6 +396,8 @@ check_status(GLuint id, opengl_build_target_t build_target, const char *shader_p
 
 /**
  * @brief Compile custom shaders into a program.
+ * Linked programs are cached on disk when the driver supports program
+ * binaries, later loads of the same source on the same driver skip compilation.
  * @return Shader program identifier.
  */
 GLuint
@@ -173,6 +408,7 @@ load_custom_shaders(const char *path)
     if (shader != NULL) {
         int success = 1;
 
+        char        version[30]         = "";
         const char *vertex_sources[3]   = { "#version 130\n", "#define VERTEX\n", shader };
         const char *fragment_sources[3] = { "#version 130\n", "#define FRAGMENT\n", shader };
 
@@ -186,8 +422,6 @@ load_custom_shaders(const char *path)
             char *version_end = strchr(version_start, '\n');
 
             if (version_end != NULL) {
-                char version[30] = "";
-
                 size_t version_len = MIN(version_end - version_start + 1, 29);
 
                 strncat(version, version_start, version_len);
@@ -202,6 +436,20 @@ load_custom_shaders(const char *path)
             memset(version_start, '/', 2);
         }
 
+        int      use_cache = shader_cache_available();
+        uint64_t cache_key = 0;
+
+        if (use_cache) {
+            cache_key = shader_cache_key(vertex_sources, fragment_sources);
+
+            GLuint cached_id = shader_cache_load(cache_key);
+
+            if (cached_id != 0) {
+                free(shader);
+                return cached_id;
+            }
+        }
+
         GLuint vertex_id   = glCreateShader(GL_VERTEX_SHADER);
         GLuint fragment_id = glCreateShader(GL_FRAGMENT_SHADER);
 
@@ -220,13 +468,23 @@ load_custom_shaders(const char *path)
         if (success) {
             prog_id = glCreateProgram();
 
+            if (use_cache)
+                shader_cache.parameteri(prog_id, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+
             glAttachShader(prog_id, vertex_id);
             glAttachShader(prog_id, fragment_id);
             glLinkProgram(prog_id);
-            check_status(prog_id, OPENGL_BUILD_TARGET_LINK, path);
+            success = check_status(prog_id, OPENGL_BUILD_TARGET_LINK, path);
 
             glDetachShader(prog_id, vertex_id);
             glDetachShader(prog_id, fragment_id);
+
+            if (!success) {
+                /* Let the caller fall back instead of drawing with a broken program. */
+                glDeleteProgram(prog_id);
+                prog_id = 0;
+            } else if (use_cache)
+                shader_cache_store(prog_id, cache_key);
         }
 
         glDeleteShader(vertex_id);
@@ -21,6 +21,7 @@
 #include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <stdatomic.h>
 #include <sys/param.h>
 
 /* This #undef is needed because a SDL include header redefines HAVE_STDARG_H. */
@@ -65,7 +66,35 @@ int                 resize_w          = 0;
 int                 resize_h          = 0;
 double              mouse_sensitivity = 1.0;                  /* Unused. */
 double              mouse_x_error = 0.0, mouse_y_error = 0.0; /* Unused. */
-static uint8_t      interpixels[17842176];
+static uint8_t     *interpixels        = NULL; /* Staging for frames that cannot go straight into the texture */
+static size_t       interpixels_size   = 0;
+static uint32_t     interpixels_shrink = 0; /* When smaller frames started to fit, 0 if not */
+static SDL_mutex   *interpixels_mutex  = NULL;
+
+#define STAGING_SHRINK_DELAY 10000 /* ms a smaller frame size must last before the staging buffer shrinks */
+
+/**
+ * States of the streaming texture while it is mapped for the blit thread.
+ * The render thread maps it right after queueing a frame, the blit thread then copies
+ * the next frame directly into the mapping and the render thread unmaps it to upload.
+ */
+enum {
+    SDL_TEX_IDLE = 0, /* Not mapped, owned by the render thread */
+    SDL_TEX_MAPPED,   /* Mapped and free for the blit thread */
+    SDL_TEX_WRITING,  /* Blit thread is copying a frame in */
+    SDL_TEX_FILLED    /* Mapping holds a complete frame */
+};
+
+static atomic_int   sdl_tex_state  = SDL_TEX_IDLE;
+static atomic_int   sdl_tex_waiting = 0;   /* Render thread sleeps on sdl_tex_state */
+static int          sdl_tex_locked = 0;    /* Render thread side, texture is locked */
+static uint8_t     *sdl_tex_pixels = NULL; /* Mapping, valid while locked */
+static int          sdl_tex_pitch  = 0;
+static int          sdl_tex_w = 0, sdl_tex_h = 0; /* Texture size, follows the emulated mode */
+static int          sdl_staging_w = 0, sdl_staging_h = 0;
+static atomic_uint  sdl_tex_seq     = 0; /* Sequence of the frame in the mapping */
+static atomic_uint  sdl_staging_seq = 0; /* Sequence of the frame in interpixels */
+static unsigned int sdl_frame_seq   = 0; /* Blit thread side frame counter */
 
 //psakhis
 static unsigned char  retSR; 
@@ -76,6 +105,13 @@ static int          sr_last_height = 0;
 static double       sr_x_scale = 1.0;
 static double       sr_y_scale = 1.0;
 
+/* Destination rectangle, recomputed only when the mode or frame size changes. */
+static struct {
+    SDL_Rect dst;
+    int      src_w, src_h; /* Frame size the rectangle was computed for */
+    int      dirty;
+} sdl_view = { { 0, 0, 0, 0 }, 0, 0, 1 };
+
 extern void RenderImGui(void);
 static void
 sdl_integer_scale(double *d, double *g)
@@ -157,8 +193,6 @@ sdl_stretch(int *w, int *h, int *x, int *y)
     gh  = (double) *h;
     hsr = hw / hh;
 
-    video_fullscreen_scale = FULLSCR_SCALE_FULL; //psakhis
-
     switch (video_fullscreen_scale) {    
         case FULLSCR_SCALE_FULL:
         default:           
@@ -212,17 +246,160 @@ sdl_stretch(int *w, int *h, int *x, int *y)
     }
 }
 
+/**
+ * Take the texture back from the blit thread, waiting out a copy in progress.
+ * Returns 0 if it was not mapped, 1 if mapped and empty, 2 if it holds a frame.
+ * The texture stays locked, the caller unlocks or destroys it.
+ */
+static int
+sdl_tex_reclaim(void)
+{
+    int state;
+
+    for (;;) {
+        state = atomic_load(&sdl_tex_state);
+
+        if (state == SDL_TEX_IDLE)
+            return 0;
+        if (state == SDL_TEX_WRITING) {
+            /* One frame copy at most, but sleep through it: the blit thread
+               may need this very core to finish. */
+            atomic_store(&sdl_tex_waiting, 1);
+            plat_wait_on(&sdl_tex_state, SDL_TEX_WRITING);
+            atomic_store(&sdl_tex_waiting, 0);
+            continue;
+        }
+        if (atomic_compare_exchange_weak(&sdl_tex_state, &state, SDL_TEX_IDLE))
+            return (state == SDL_TEX_FILLED) ? 2 : 1;
+    }
+}
+
+/* Blit thread side, leave SDL_TEX_WRITING and wake sdl_tex_reclaim() if it waits. */
+static void
+sdl_tex_release(int state)
+{
+    atomic_store(&sdl_tex_state, state);
+
+    if (atomic_load(&sdl_tex_waiting))
+        plat_wake_all(&sdl_tex_state);
+}
+
+/* Hand the texture to the blit thread. */
+static void
+sdl_tex_map(void)
+{
+    void *pixels;
+    int   pitch;
+
+    if ((sdl_tex == NULL) || sdl_tex_locked)
+        return;
+
+    /* Software and some hardware renderers may refuse, frames then go through interpixels. */
+    if (SDL_LockTexture(sdl_tex, NULL, &pixels, &pitch) < 0)
+        return;
+
+    sdl_tex_locked = 1;
+    sdl_tex_pixels = (uint8_t *) pixels;
+    sdl_tex_pitch  = pitch;
+    atomic_store(&sdl_tex_state, SDL_TEX_MAPPED);
+}
+
+/* (Re-)create the texture at the given size, the blit thread must not hold it. */
+static void
+sdl_tex_create(int w, int h)
+{
+    if (sdl_tex != NULL)
+        SDL_DestroyTexture(sdl_tex);
+
+    sdl_tex_locked = 0;
+    sdl_tex_w      = w;
+    sdl_tex_h      = h;
+    sdl_tex        = SDL_CreateTexture(sdl_render, SDL_PIXELFORMAT_ARGB8888,
+                                       SDL_TEXTUREACCESS_STREAMING, w, h);
+}
+
+/* Size the staging buffer for a frame, with interpixels_mutex held. */
+static int
+sdl_staging_reserve(size_t bytes)
+{
+    size_t   size = 0;
+    uint32_t now  = plat_get_ticks();
+
+    if (bytes > interpixels_size) {
+        size = bytes;
+    } else if (bytes < interpixels_size) {
+        if (!interpixels_shrink)
+            interpixels_shrink = now | 1;
+        else if ((now - interpixels_shrink) >= STAGING_SHRINK_DELAY)
+            size = bytes;
+    } else
+        interpixels_shrink = 0;
+
+    if (size) {
+        uint8_t *buf = realloc(interpixels, size);
+
+        if (buf == NULL)
+            return bytes <= interpixels_size;
+
+        interpixels        = buf;
+        interpixels_size   = size;
+        interpixels_shrink = 0;
+    }
+
+    return 1;
+}
+
 void
 sdl_blit_shim(int x, int y, int w, int h, int monitor_index)
-{        	       
+{
+    int row;
+    int state = SDL_TEX_MAPPED;
+
     params.x = x;
     params.y = y;
     params.w = w;
-    params.h = h;        
-    if (!(!sdl_enabled || (x < 0) || (y < 0) || (w <= 0) || (h <= 0) || (w > 2048) || (h > 2048) || (buffer32 == NULL) || (sdl_render == NULL) || (sdl_tex == NULL)) || (monitor_index >= 1)) 
-        video_copy(interpixels, &(buffer32->line[y][x]), h * 2048 * sizeof(uint32_t));           
-    if (screenshots)
-        video_screenshot(interpixels, 0, 0, 2048);
+    params.h = h;
+    if (!sdl_enabled || (x < 0) || (y < 0) || (w <= 0) || (h <= 0) || (w > 2048) || (h > 2048) || (blit_buffer32 == NULL) || (sdl_render == NULL) || (sdl_tex == NULL) || (monitor_index >= 1)) {
+        blitreq = 1;
+        video_blit_complete_monitor(monitor_index);
+        return;
+    }
+
+    sdl_frame_seq++;
+
+    if (atomic_compare_exchange_strong(&sdl_tex_state, &state, SDL_TEX_WRITING)) {
+        /* The size is only stable once the mapping is ours. */
+        if ((w == sdl_tex_w) && (h == sdl_tex_h)) {
+            for (row = 0; row < h; ++row)
+                video_copy(&sdl_tex_pixels[row * sdl_tex_pitch], &(blit_buffer32->line[y + row][x]), w * sizeof(uint32_t));
+            if (screenshots)
+                video_screenshot((uint32_t *) sdl_tex_pixels, 0, 0, sdl_tex_pitch / sizeof(uint32_t));
+
+            atomic_store(&sdl_tex_seq, sdl_frame_seq);
+            sdl_tex_release(SDL_TEX_FILLED);
+
+            blitreq = 1;
+            video_blit_complete_monitor(monitor_index);
+            return;
+        }
+
+        sdl_tex_release(SDL_TEX_MAPPED);
+    }
+
+    /* Texture busy or being resized for a new mode, stage the frame. */
+    SDL_LockMutex(interpixels_mutex);
+    if (sdl_staging_reserve(w * h * sizeof(uint32_t))) {
+        for (row = 0; row < h; ++row)
+            video_copy(&interpixels[row * w * sizeof(uint32_t)], &(blit_buffer32->line[y + row][x]), w * sizeof(uint32_t));
+        if (screenshots)
+            video_screenshot((uint32_t *) interpixels, 0, 0, w);
+
+        sdl_staging_w = w;
+        sdl_staging_h = h;
+        atomic_store(&sdl_staging_seq, sdl_frame_seq);
+    }
+    SDL_UnlockMutex(interpixels_mutex);
+
     blitreq = 1;
     video_blit_complete_monitor(monitor_index);
 }
@@ -237,10 +414,18 @@ sdl_real_blit(SDL_Rect *r_src)
     //SDL_GL_GetDrawableSize(sdl_win, &winx, &winy); 
     SDL_RenderClear(sdl_render);
 
-    r_dst   = *r_src;
-    r_dst.x = r_dst.y = 0;
+    if (sdl_view.dirty || (r_src->w != sdl_view.src_w) || (r_src->h != sdl_view.src_h)) {
+        r_dst   = *r_src;
+        r_dst.x = r_dst.y = 0;
+
+        sdl_stretch(&r_dst.w, &r_dst.h, &r_dst.x, &r_dst.y);
 
-    sdl_stretch(&r_dst.w, &r_dst.h, &r_dst.x, &r_dst.y);
+        sdl_view.dst   = r_dst;
+        sdl_view.src_w = r_src->w;
+        sdl_view.src_h = r_src->h;
+        sdl_view.dirty = 0;
+    }
+    r_dst = sdl_view.dst;
 
     /*if (sdl_fs) {
         sdl_stretch(&r_dst.w, &r_dst.h, &r_dst.x, &r_dst.y);
@@ -252,7 +437,11 @@ sdl_real_blit(SDL_Rect *r_src)
     if (ret)
         fprintf(stderr, "SDL: unable to copy texture to renderer (%s)\n", SDL_GetError());
 
+    /* Map before presenting, the blit thread can fill it while we wait for vsync. */
+    sdl_tex_map();
+
     SDL_RenderPresent(sdl_render);
+    switchres_stats_end();
 }
 
 void
@@ -276,6 +465,7 @@ sdl_blit(int x, int y, int w, int h)
     sr_mode swres_result;      	           
     if (switchres_switch) {   
         pclog("Mode detected %dx%d@%f (%d)\n",switchres_width,switchres_height,switchres_freq,switchres_interlace);                
+        switchres_stats_begin();
         struct timeval tval_before, tval_after, tval_result;
         gettimeofday(&tval_before, NULL);
         
@@ -299,6 +489,7 @@ sdl_blit(int x, int y, int w, int h)
         sr_x_scale = swres_result.x_scale;       
         sr_y_scale = swres_result.y_scale;        
         switchres_switch = 0; 
+        sdl_view.dirty = 1;
         
         gettimeofday(&tval_after, NULL);
         timersub(&tval_after, &tval_before, &tval_result);
@@ -313,11 +504,49 @@ sdl_blit(int x, int y, int w, int h)
         resize_pending = 0;
     }*/   
             
-    r_src.x = x;
-    r_src.y = y;
+    int held = sdl_tex_reclaim();
+    int row;
+
+    /* Staging is reallocated by the blit thread, keep it in place while reading. */
+    SDL_LockMutex(interpixels_mutex);
+
+    if ((held == 2) && (atomic_load(&sdl_tex_seq) >= atomic_load(&sdl_staging_seq))) {
+        /* Newest frame is already in the mapping, unlocking uploads it. */
+        SDL_UnlockTexture(sdl_tex);
+        sdl_tex_locked = 0;
+        w = sdl_tex_w;
+        h = sdl_tex_h;
+    } else {
+        w = sdl_staging_w;
+        h = sdl_staging_h;
+
+        if ((w <= 0) || (h <= 0)) {
+            /* Nothing staged yet, present what the texture holds. */
+            if (held) {
+                SDL_UnlockTexture(sdl_tex);
+                sdl_tex_locked = 0;
+            }
+            w = sdl_tex_w;
+            h = sdl_tex_h;
+        } else if ((w != sdl_tex_w) || (h != sdl_tex_h)) {
+            /* Mode changed, size the texture to it. */
+            sdl_tex_create(w, h);
+            SDL_UpdateTexture(sdl_tex, NULL, interpixels, w * 4);
+        } else if (held) {
+            for (row = 0; row < h; ++row)
+                memcpy(&sdl_tex_pixels[row * sdl_tex_pitch], &interpixels[row * w * 4], w * 4);
+            SDL_UnlockTexture(sdl_tex);
+            sdl_tex_locked = 0;
+        } else
+            SDL_UpdateTexture(sdl_tex, NULL, interpixels, w * 4);
+    }
+
+    SDL_UnlockMutex(interpixels_mutex);
+
+    r_src.x = 0;
+    r_src.y = 0;
     r_src.w = w;
-    r_src.h = h;             
-    SDL_UpdateTexture(sdl_tex, &r_src, interpixels, 2048 * 4);
+    r_src.h = h;
     blitreq = 0;    
               
     sdl_real_blit(&r_src);
@@ -340,6 +569,10 @@ sdl_destroy_window(void)
 static void
 sdl_destroy_texture(void)
 {
+    /* Make sure the blit thread is not copying into the mapping. */
+    sdl_tex_reclaim();
+    sdl_tex_locked = 0;
+
     /* SDL_DestroyRenderer also automatically destroys all associated textures. */
     if (sdl_render != NULL) {
         SDL_DestroyRenderer(sdl_render);
@@ -367,6 +600,14 @@ sdl_close(void)
     
     sdl_destroy_texture();             
     sdl_destroy_window();       
+
+    if (interpixels_mutex != NULL) {
+        SDL_DestroyMutex(interpixels_mutex);
+        interpixels_mutex = NULL;
+    }
+    free(interpixels);
+    interpixels      = NULL;
+    interpixels_size = 0;
     
     /* Quit. */
     SDL_Quit();
@@ -409,6 +650,7 @@ void
 sdl_reinit_texture(void)
 {
     sdl_destroy_texture();
+    sdl_view.dirty = 1;
 
     if (sdl_flags & RENDERER_HARDWARE) {    	
     	sdl_flags = SDL_RENDERER_ACCELERATED;
@@ -418,8 +660,11 @@ sdl_reinit_texture(void)
     } else
         sdl_render = SDL_CreateRenderer(sdl_win, -1, SDL_RENDERER_SOFTWARE);
 
-    sdl_tex = SDL_CreateTexture(sdl_render, SDL_PIXELFORMAT_ARGB8888,
-                                SDL_TEXTUREACCESS_STREAMING, 2048, 2048);
+    sdl_tex = NULL;
+    if ((sdl_tex_w <= 0) || (sdl_tex_h <= 0))
+        sdl_tex_create(640, 480);
+    else
+        sdl_tex_create(sdl_tex_w, sdl_tex_h);
 }
 
 void
@@ -508,8 +753,9 @@ sdl_init_common(int flags)
             sdl_select_best_hw_driver();
     }
 
-    sdl_mutex = SDL_CreateMutex();
-    sdl_win   = SDL_CreateWindow("86Box", strncasecmp(SDL_GetCurrentVideoDriver(), "wayland", 7) != 0 && window_remember ? window_x : SDL_WINDOWPOS_CENTERED, strncasecmp(SDL_GetCurrentVideoDriver(), "wayland", 7) != 0 && window_remember ? window_y : SDL_WINDOWPOS_CENTERED, scrnsz_x, scrnsz_y, SDL_WINDOW_OPENGL | (vid_resize & 1 ? SDL_WINDOW_RESIZABLE : 0));    
+    sdl_mutex         = SDL_CreateMutex();
+    interpixels_mutex = SDL_CreateMutex();
+    sdl_win           = SDL_CreateWindow("86Box", strncasecmp(SDL_GetCurrentVideoDriver(), "wayland", 7) != 0 && window_remember ? window_x : SDL_WINDOWPOS_CENTERED, strncasecmp(SDL_GetCurrentVideoDriver(), "wayland", 7) != 0 && window_remember ? window_y : SDL_WINDOWPOS_CENTERED, scrnsz_x, scrnsz_y, SDL_WINDOW_OPENGL | (vid_resize & 1 ? SDL_WINDOW_RESIZABLE : 0));    
     
     if (!sdl_display()) {
     	pclog("Failed to index display %d.\n", vid_display);
@@ -531,6 +777,8 @@ sdl_init_common(int flags)
     sr_real_width = 640;
     sr_real_height = 480; 
     SDL_GL_GetDrawableSize(sdl_win, &sr_last_width, &sr_last_height);  
+    video_fullscreen_scale = FULLSCR_SCALE_FULL; /* Switchres sizes the output, set once rather than per frame. */
+    sdl_view.dirty = 1;
     //end psakhis
 
     /* Make sure we get a clean exit. */